@@ -0,0 +1,58 @@
+#ifndef SAMPLER_ALIGNED_H_
+#define SAMPLER_ALIGNED_H_
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+namespace sampler {
+
+// Bytes in a cache line on the targets we run on.
+const size_t kCacheLineSize = 64;
+
+// Allocator returning cache-line aligned storage, so that table rows start
+// on a line boundary and vector loads over them never split lines.
+template <typename T>
+class AlignedAllocator {
+  public:
+  typedef T value_type;
+
+  template <typename U>
+  struct rebind {
+    typedef AlignedAllocator<U> other;
+  };
+
+  AlignedAllocator() {}
+  template <typename U>
+  AlignedAllocator(const AlignedAllocator<U>&) {}
+
+  T* allocate(size_t n) {
+    void* memory = nullptr;
+    if (posix_memalign(&memory, kCacheLineSize, n * sizeof(T)) != 0) {
+      throw std::bad_alloc();
+    }
+    return static_cast<T*>(memory);
+  }
+
+  void deallocate(T* memory, size_t) {
+    free(memory);
+  }
+};
+
+template <typename T, typename U>
+bool operator==(const AlignedAllocator<T>&, const AlignedAllocator<U>&) {
+  return true;
+}
+
+template <typename T, typename U>
+bool operator!=(const AlignedAllocator<T>&, const AlignedAllocator<U>&) {
+  return false;
+}
+
+template <typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+}  // namespace sampler
+
+#endif  // SAMPLER_ALIGNED_H_
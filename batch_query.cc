@@ -0,0 +1,87 @@
+#include <atomic>
+#include <iostream>
+
+#include "batch_query.h"
+#include "framework.h"
+#include "scheduler.h"
+
+namespace sampler {
+
+BatchQueryRunner::BatchQueryRunner(const ModelFactory& factory, Scheduler* scheduler) :
+  scheduler_(scheduler),
+  seed_(0)
+{
+  for (int i = 0; i < scheduler_->GetNumWorkers(); ++i) {
+    Sampler* sampler = factory();
+    samplers_.emplace_back(sampler);
+    sampler->SetScheduler(scheduler_);
+    sampler->SetVerbose(false);
+    model_evidence_.emplace_back();
+    for (int node_idx = 0; node_idx < sampler->GetNumNodes(); ++node_idx) {
+      Node* node = sampler->GetNode(node_idx);
+      if (node->IsEvidence()) {
+        model_evidence_.back()[node_idx] = node->GetValue();
+      }
+    }
+  }
+  if (!samplers_.empty()) {
+    seed_ = samplers_[0]->GetSeed();
+  }
+}
+
+int BatchQueryRunner::GetNumSamplers() const {
+  return samplers_.size();
+}
+
+void BatchQueryRunner::SetSeed(uint64_t seed) {
+  seed_ = seed;
+}
+
+void BatchQueryRunner::Run(const std::vector<EvidenceAssignment>& queries,
+                           int num_iterations,
+                           std::vector<std::string>* summaries) {
+  summaries->clear();
+  summaries->resize(queries.size());
+
+  // One task per Sampler; tasks pull query indices from a shared counter so
+  // that slow queries do not leave the other workers idle.
+  std::atomic<int> next_query(0);
+  scheduler_->ParallelFor(samplers_.size(), [this, &queries, num_iterations, summaries, &next_query](int t) {
+    for (int q = next_query++; q < queries.size(); q = next_query++) {
+      AnswerQuery(t, q, queries[q], num_iterations, &(*summaries)[q]);
+    }
+  });
+}
+
+void BatchQueryRunner::AnswerQuery(int sampler_idx,
+                                   int query_idx,
+                                   const EvidenceAssignment& evidence,
+                                   int num_iterations,
+                                   std::string* summary) {
+  Sampler* sampler = samplers_[sampler_idx].get();
+  summary->clear();
+  for (const auto& observation : evidence) {
+    if (observation.first < 0 || observation.first >= sampler->GetNumNodes()) {
+      std::cerr << "BatchQueryRunner::AnswerQuery no node " << observation.first
+                << " in a model of " << sampler->GetNumNodes() << " nodes, skipping query" << std::endl;
+      return;
+    }
+    if (!sampler->GetNode(observation.first)->IsEvidence()) {
+      std::cerr << "BatchQueryRunner::AnswerQuery node [" << sampler->GetNode(observation.first)->GetName()
+                << "] is not evidence, skipping query" << std::endl;
+      return;
+    }
+  }
+  for (const auto& observation : model_evidence_[sampler_idx]) {
+    sampler->GetNode(observation.first)->SetValue(observation.second);
+  }
+  for (const auto& observation : evidence) {
+    sampler->GetNode(observation.first)->SetValue(observation.second);
+  }
+  sampler->SetSeed(DeriveSeed(seed_, query_idx));
+  sampler->Reset();
+  sampler->Infer(num_iterations);
+  *summary = sampler->GetWorker()->ToJsonString();
+}
+
+}  // namespace sampler
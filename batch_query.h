@@ -0,0 +1,70 @@
+#ifndef SAMPLER_BATCH_QUERY_H_
+#define SAMPLER_BATCH_QUERY_H_
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+class Sampler;
+
+namespace sampler {
+
+class Scheduler;
+
+// Observed values for one query, keyed by Sampler::Register() index.
+// Every key must refer to a node that the model registered as evidence.
+typedef std::map<int, double> EvidenceAssignment;
+
+// Builds a fully wired model: Nodes, edges and a Worker registered with a
+// new Sampler. The runner calls it once per thread, never per query.
+typedef std::function<Sampler*()> ModelFactory;
+
+// Answers many posterior queries that share one network structure and differ
+// only in evidence values. One Sampler (nodes, chain state and Worker
+// buffers) is built per Scheduler worker and reused for every query that
+// worker's task picks up. Before each query the runner puts back the
+// evidence values the factory set, so an evidence node a query does not
+// name keeps the model's value rather than the previous query's, and
+// reseeds the Sampler from the query's index, so an answer does not depend
+// on which Sampler ran it or what ran there before. Engine state that
+// outlives Reset() by design, such as adapted block proposals, still
+// carries over between queries. The runner turns off the Samplers' progress logging
+// (Sampler::SetVerbose) since it sits on the query path.
+class BatchQueryRunner {
+  public:
+  // Does not take ownership of scheduler, which must outlive the runner.
+  BatchQueryRunner(const ModelFactory& factory, Scheduler* scheduler);
+
+  // Runs num_iterations sweeps per query. summaries[i] receives
+  // Worker::ToJsonString() of the Worker after answering queries[i], or
+  // stays empty if queries[i] names a node the model does not have or a
+  // node that is not evidence.
+  void Run(const std::vector<EvidenceAssignment>& queries,
+           int num_iterations,
+           std::vector<std::string>* summaries);
+
+  int GetNumSamplers() const;
+  // Query i runs with Sampler::SetSeed(DeriveSeed(seed, i)). Defaults to
+  // the seed of the first Sampler the factory built.
+  void SetSeed(uint64_t seed);
+
+  private:
+  void AnswerQuery(int sampler_idx,
+                   int query_idx,
+                   const EvidenceAssignment& evidence,
+                   int num_iterations,
+                   std::string* summary);
+
+  Scheduler* scheduler_;
+  std::vector<std::unique_ptr<Sampler>> samplers_;
+  // Per Sampler, the evidence values its factory set.
+  std::vector<EvidenceAssignment> model_evidence_;
+  uint64_t seed_;
+};
+
+}  // namespace sampler
+
+#endif  // SAMPLER_BATCH_QUERY_H_
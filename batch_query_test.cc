@@ -0,0 +1,165 @@
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "batch_query.h"
+#include "framework.h"
+#include "scheduler.h"
+#include "test_util.h"
+
+namespace {
+
+// x ~ N(0, 4) and observed y | x ~ N(x, 1), so E[x | y] = 4 y / 5.
+const int kEvidenceIdx = 1;
+const double kPosteriorSlope = 0.8;
+
+// Summarizes the samples of node 0 as {"mean":...}.
+class MeanWorker : public Worker {
+  public:
+  MeanWorker() : sum_(0.0), num_samples_(0) {}
+  void Reset() override {
+    sum_ = 0.0;
+    num_samples_ = 0;
+  }
+  void Sample(Sampler* sampler) override {
+    sum_ += sampler->GetNode(0)->GetValue();
+    ++num_samples_;
+  }
+  std::string ToJsonString() const override {
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "{\"mean\":%.17g}", sum_ / num_samples_);
+    return buffer;
+  }
+
+  private:
+  double sum_;
+  int64_t num_samples_;
+};
+
+double ParseMean(const std::string& summary) {
+  const size_t colon = summary.find(':');
+  return colon == std::string::npos ? 0.0 : strtod(summary.c_str() + colon + 1, nullptr);
+}
+
+void AddModel(Sampler* sampler) {
+  Node* x = new GaussianNode({0.0}, 4.0, "x");
+  Node* y = new GaussianEvidenceNode({0.0, 1.0}, 1.0, 0.0, "y");
+  y->EdgeFrom(x);
+  sampler->Register(x);
+  sampler->Register(y);
+}
+
+Sampler* NewMetroModel() {
+  MetroSampler* sampler = new MetroSampler(new GaussianProposalDensity1D(1.5));
+  AddModel(sampler);
+  sampler->Register(new MeanWorker);
+  return sampler;
+}
+
+// x ~ N(0, 4) with two observations y1, y2 | x ~ N(x, 1), both 0 unless a
+// query says otherwise: E[x | y1, y2] = (y1 + y2) / (1 / 4 + 2).
+Sampler* NewTwoObservationModel() {
+  MetroSampler* sampler = new MetroSampler(new GaussianProposalDensity1D(1.5));
+  Node* x = new GaussianNode({0.0}, 4.0, "x");
+  Node* y1 = new GaussianEvidenceNode({0.0, 1.0}, 1.0, 0.0, "y1");
+  Node* y2 = new GaussianEvidenceNode({0.0, 1.0}, 1.0, 0.0, "y2");
+  y1->EdgeFrom(x);
+  y2->EdgeFrom(x);
+  sampler->Register(x);
+  sampler->Register(y1);
+  sampler->Register(y2);
+  sampler->Register(new MeanWorker);
+  return sampler;
+}
+
+void TestPosteriorMeans() {
+  sampler::SchedulerOptions options;
+  options.num_workers = 3;
+  sampler::Scheduler scheduler(options);
+  sampler::BatchQueryRunner runner(NewMetroModel, &scheduler);
+  EXPECT_TRUE(runner.GetNumSamplers() == 3);
+
+  std::vector<sampler::EvidenceAssignment> queries;
+  for (int i = 0; i < 12; ++i) {
+    queries.push_back({{kEvidenceIdx, -5.0 + i}});
+  }
+  std::vector<std::string> summaries;
+  runner.Run(queries, 20000, &summaries);
+  EXPECT_TRUE(summaries.size() == queries.size());
+  for (int i = 0; i < queries.size() && i < summaries.size(); ++i) {
+    EXPECT_NEAR(ParseMean(summaries[i]), kPosteriorSlope * queries[i].at(kEvidenceIdx), 0.15);
+  }
+}
+
+void TestInvalidQueriesAreSkipped() {
+  sampler::SchedulerOptions options;
+  options.num_workers = 2;
+  sampler::Scheduler scheduler(options);
+  sampler::BatchQueryRunner runner(NewMetroModel, &scheduler);
+
+  std::vector<std::string> summaries;
+  runner.Run({{{kEvidenceIdx, 5.0}}, {{7, 1.0}}, {{-1, 1.0}}}, 2000, &summaries);
+  EXPECT_TRUE(summaries.size() == 3);
+  if (summaries.size() == 3) {
+    EXPECT_TRUE(!summaries[0].empty());
+    EXPECT_TRUE(summaries[1].empty());
+    EXPECT_TRUE(summaries[2].empty());
+  }
+
+  // x is latent; observing it is rejected the same way.
+  runner.Run({{{0, 1.0}}}, 2000, &summaries);
+  EXPECT_TRUE(summaries.size() == 1 && summaries[0].empty());
+}
+
+// With one Sampler every query reuses it: evidence a query does not name
+// must come back to the model's value, not stay at the previous query's.
+void TestEvidenceDoesNotLeakBetweenQueries() {
+  sampler::SchedulerOptions options;
+  options.num_workers = 1;
+  sampler::Scheduler scheduler(options);
+  sampler::BatchQueryRunner runner(NewTwoObservationModel, &scheduler);
+
+  std::vector<std::string> summaries;
+  runner.Run({{{1, 0.0}, {2, 10.0}}, {{1, 0.0}}, {{1, 4.5}}}, 20000, &summaries);
+  EXPECT_TRUE(summaries.size() == 3);
+  if (summaries.size() == 3) {
+    EXPECT_NEAR(ParseMean(summaries[0]), 10.0 / 2.25, 0.1);
+    EXPECT_NEAR(ParseMean(summaries[1]), 0.0, 0.1);
+    EXPECT_NEAR(ParseMean(summaries[2]), 4.5 / 2.25, 0.1);
+  }
+}
+
+// Each query is seeded from its index, so answers do not depend on how
+// many Samplers there are, which one ran a query, or what ran before.
+void TestAnswersDoNotDependOnScheduling() {
+  std::vector<sampler::EvidenceAssignment> queries;
+  for (int i = 0; i < 8; ++i) {
+    queries.push_back({{1, i - 4.0}, {2, 0.5 * i}});
+  }
+  std::vector<std::vector<std::string>> results;
+  for (int num_workers : {1, 3}) {
+    sampler::SchedulerOptions options;
+    options.num_workers = num_workers;
+    sampler::Scheduler scheduler(options);
+    sampler::BatchQueryRunner runner(NewTwoObservationModel, &scheduler);
+    runner.SetSeed(7);
+    for (int repeat = 0; repeat < 2; ++repeat) {
+      results.emplace_back();
+      runner.Run(queries, 500, &results.back());
+    }
+  }
+  for (const std::vector<std::string>& summaries : results) {
+    EXPECT_TRUE(summaries == results[0]);
+  }
+}
+
+}  // namespace
+
+int main() {
+  TestPosteriorMeans();
+  TestInvalidQueriesAreSkipped();
+  TestEvidenceDoesNotLeakBetweenQueries();
+  TestAnswersDoNotDependOnScheduling();
+  return sampler::testing::TestResult();
+}
@@ -0,0 +1,158 @@
+#include <cmath>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "exact_gaussian.h"
+#include "framework.h"
+#include "test_util.h"
+
+namespace {
+
+// Running means and covariance of nodes 0 and 1.
+class PairMomentsWorker : public Worker {
+  public:
+  PairMomentsWorker() {
+    Reset();
+  }
+  void Reset() override {
+    num_samples_ = 0;
+    mean_[0] = mean_[1] = 0.0;
+    comoment_[0] = comoment_[1] = comoment_[2] = 0.0;
+  }
+  void Sample(Sampler* sampler) override {
+    const double values[] = {sampler->GetNode(0)->GetValue(), sampler->GetNode(1)->GetValue()};
+    ++num_samples_;
+    double deltas[2];
+    for (int i = 0; i < 2; ++i) {
+      deltas[i] = values[i] - mean_[i];
+      mean_[i] += deltas[i] / num_samples_;
+    }
+    comoment_[0] += deltas[0] * (values[0] - mean_[0]);
+    comoment_[1] += deltas[0] * (values[1] - mean_[1]);
+    comoment_[2] += deltas[1] * (values[1] - mean_[1]);
+  }
+  std::string ToJsonString() const override {
+    return "";
+  }
+  double GetMean(int i) const {
+    return mean_[i];
+  }
+  // Row-major 2 x 2.
+  double GetCovariance(int i, int j) const {
+    return comoment_[i + j] / (num_samples_ - 1);
+  }
+
+  private:
+  int64_t num_samples_;
+  double mean_[2];
+  double comoment_[3];
+};
+
+// x ~ N(0, 1), y | x ~ N(x, 0.01) and z | y ~ N(y, 0.5) observed at 1.5:
+// the posterior of (x, y) is a narrow ridge along x = y, which scalar
+// steps cross slowly.
+void AddCorrelatedPair(Sampler* sampler) {
+  Node* x = new GaussianNode({0.0}, 1.0, "x");
+  Node* y = new GaussianNode({0.0, 1.0}, 0.01, "y");
+  Node* z = new GaussianEvidenceNode({0.0, 1.0}, 0.5, 1.5, "z");
+  y->EdgeFrom(x);
+  z->EdgeFrom(y);
+  sampler->Register(x);
+  sampler->Register(y);
+  sampler->Register(z);
+}
+
+MetroSampler* NewPairSampler() {
+  MetroSampler* sampler = new MetroSampler(new GaussianProposalDensity1D(0.1));
+  sampler->SetVerbose(false);
+  AddCorrelatedPair(sampler);
+  sampler->Register(new PairMomentsWorker);
+  return sampler;
+}
+
+void GetExactMoments(std::vector<double>* mean, std::vector<double>* covariance) {
+  ExactGaussianEngine engine;
+  engine.SetVerbose(false);
+  AddCorrelatedPair(&engine);
+  EXPECT_TRUE(engine.GetPosteriorMean(mean));
+  EXPECT_TRUE(engine.GetPosteriorCovariance(covariance));
+}
+
+// Burns in over the adaptation sweeps, then compares the sampled moments
+// with the exact posterior.
+void ExpectExactMoments(MetroSampler* sampler) {
+  std::vector<double> mean;
+  std::vector<double> covariance;
+  GetExactMoments(&mean, &covariance);
+  sampler->Reset();
+  sampler->Infer(5000);
+  sampler->GetWorker()->Reset();
+  sampler->Infer(100000);
+  const PairMomentsWorker* worker = static_cast<const PairMomentsWorker*>(sampler->GetWorker());
+  for (int i = 0; i < 2; ++i) {
+    EXPECT_NEAR(worker->GetMean(i), mean[i], 0.05 * sqrt(covariance[3 * i]));
+    for (int j = 0; j < 2; ++j) {
+      EXPECT_NEAR(worker->GetCovariance(i, j), covariance[2 * i + j], 0.05 * covariance[0]);
+    }
+  }
+}
+
+void TestAdaptedBlockMatchesExactPosterior() {
+  std::unique_ptr<MetroSampler> sampler(NewPairSampler());
+  EXPECT_TRUE(sampler->AddBlock({0, 1}, new GaussianProposalDensityND(2, 0.1)));
+  sampler->SetAdaptationIterations(2000);
+  ExpectExactMoments(sampler.get());
+}
+
+void TestAutomaticBlocksMatchExactPosterior() {
+  std::unique_ptr<MetroSampler> sampler(NewPairSampler());
+  sampler->AddAutomaticBlocks(2, 0.1);
+  // Both nodes are now in one block.
+  EXPECT_TRUE(!sampler->AddBlock({0}, new GaussianProposalDensityND(1, 0.1)));
+  EXPECT_TRUE(!sampler->AddBlock({1}, new GaussianProposalDensityND(1, 0.1)));
+  sampler->SetAdaptationIterations(2000);
+  ExpectExactMoments(sampler.get());
+}
+
+// A unit isotropic proposal rarely lands on the ridge; once adapted to the
+// posterior covariance, the proposal follows it.
+void TestAdaptationRaisesAcceptance() {
+  double acceptance_rates[2];
+  for (int adapt = 0; adapt < 2; ++adapt) {
+    std::unique_ptr<MetroSampler> sampler(NewPairSampler());
+    sampler->AddBlock({0, 1}, new GaussianProposalDensityND(2, 1.0));
+    sampler->SetAdaptationIterations(adapt ? 2000 : 0);
+    sampler->Reset();
+    sampler->Infer(2000);
+    sampler->Reset();
+    sampler->Infer(20000);
+    acceptance_rates[adapt] = sampler->GetAcceptanceRate();
+  }
+  EXPECT_TRUE(acceptance_rates[1] > 3.0 * acceptance_rates[0]);
+}
+
+void TestAddBlockRejections() {
+  std::unique_ptr<MetroSampler> sampler(NewPairSampler());
+  // Out of range, repeated, evidence, mismatched dimension and empty.
+  EXPECT_TRUE(!sampler->AddBlock({0, 3}, new GaussianProposalDensityND(2, 0.1)));
+  EXPECT_TRUE(!sampler->AddBlock({0, -1}, new GaussianProposalDensityND(2, 0.1)));
+  EXPECT_TRUE(!sampler->AddBlock({0, 0}, new GaussianProposalDensityND(2, 0.1)));
+  EXPECT_TRUE(!sampler->AddBlock({0, 2}, new GaussianProposalDensityND(2, 0.1)));
+  EXPECT_TRUE(!sampler->AddBlock({0, 1}, new GaussianProposalDensityND(3, 0.1)));
+  EXPECT_TRUE(!sampler->AddBlock({}, new GaussianProposalDensityND(0, 0.1)));
+  // None of those added anything, so the nodes are still free.
+  EXPECT_TRUE(sampler->AddBlock({0, 1}, new GaussianProposalDensityND(2, 0.1)));
+  EXPECT_TRUE(!sampler->AddBlock({1}, new GaussianProposalDensityND(1, 0.1)));
+  EXPECT_TRUE(!sampler->AddExactGaussianBlock({0}));
+}
+
+}  // namespace
+
+int main() {
+  TestAdaptedBlockMatchesExactPosterior();
+  TestAutomaticBlocksMatchExactPosterior();
+  TestAdaptationRaisesAcceptance();
+  TestAddBlockRejections();
+  return sampler::testing::TestResult();
+}
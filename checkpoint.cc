@@ -0,0 +1,216 @@
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "checkpoint.h"
+
+namespace sampler {
+
+StateWriter::StateWriter(std::string* out) :
+  out_(out)
+{}
+
+void StateWriter::WriteBytes(const void* data, size_t num_bytes) {
+  out_->append(static_cast<const char*>(data), num_bytes);
+}
+
+void StateWriter::WriteInt64(int64_t value) {
+  WriteBytes(&value, sizeof(value));
+}
+
+void StateWriter::WriteDouble(double value) {
+  WriteBytes(&value, sizeof(value));
+}
+
+void StateWriter::WriteString(const std::string& value) {
+  WriteInt64(value.size());
+  WriteBytes(value.data(), value.size());
+}
+
+void StateWriter::WriteDoubles(const std::vector<double>& values) {
+  WriteInt64(values.size());
+  WriteBytes(values.data(), values.size() * sizeof(double));
+}
+
+void StateWriter::WriteInts(const std::vector<int>& values) {
+  WriteInt64(values.size());
+  for (int value : values) {
+    WriteInt64(value);
+  }
+}
+
+StateReader::StateReader(const std::string& in) :
+  in_(in),
+  pos_(0),
+  ok_(true)
+{}
+
+bool StateReader::ReadBytes(void* data, size_t num_bytes) {
+  if (!ok_ || in_.size() - pos_ < num_bytes) {
+    ok_ = false;
+    return false;
+  }
+  memcpy(data, in_.data() + pos_, num_bytes);
+  pos_ += num_bytes;
+  return true;
+}
+
+bool StateReader::ReadInt64(int64_t* value) {
+  return ReadBytes(value, sizeof(*value));
+}
+
+bool StateReader::ReadDouble(double* value) {
+  return ReadBytes(value, sizeof(*value));
+}
+
+bool StateReader::ReadString(std::string* value) {
+  int64_t size = 0;
+  if (!ReadInt64(&size) || size < 0 || in_.size() - pos_ < size) {
+    ok_ = false;
+    return false;
+  }
+  value->assign(in_, pos_, size);
+  pos_ += size;
+  return true;
+}
+
+bool StateReader::ReadDoubles(std::vector<double>* values) {
+  int64_t size = 0;
+  if (!ReadInt64(&size) || size < 0 || (in_.size() - pos_) / sizeof(double) < size) {
+    ok_ = false;
+    return false;
+  }
+  values->resize(size);
+  return ReadBytes(values->data(), size * sizeof(double));
+}
+
+bool StateReader::ReadInts(std::vector<int>* values) {
+  int64_t size = 0;
+  if (!ReadInt64(&size) || size < 0 || (in_.size() - pos_) / sizeof(int64_t) < size) {
+    ok_ = false;
+    return false;
+  }
+  values->resize(size);
+  for (int i = 0; i < size; ++i) {
+    int64_t value = 0;
+    ReadInt64(&value);
+    (*values)[i] = value;
+  }
+  return ok_;
+}
+
+bool StateReader::AtEnd() const {
+  return ok_ && pos_ == in_.size();
+}
+
+Checkpointer::Checkpointer(const std::string& path) :
+  path_(path),
+  has_pending_(false),
+  is_writing_(false),
+  stopping_(false),
+  writer_(&Checkpointer::WriterLoop, this)
+{}
+
+Checkpointer::~Checkpointer() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  cv_.notify_all();
+  writer_.join();
+}
+
+const std::string& Checkpointer::GetPath() const {
+  return path_;
+}
+
+void Checkpointer::WriteAsync(std::string snapshot) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_.swap(snapshot);
+    has_pending_ = true;
+  }
+  cv_.notify_all();
+}
+
+void Checkpointer::Flush() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  cv_.wait(lock, [this]() { return !has_pending_ && !is_writing_; });
+}
+
+void Checkpointer::WriterLoop() {
+  std::string snapshot;
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    cv_.wait(lock, [this]() { return has_pending_ || stopping_; });
+    if (!has_pending_) {
+      return;
+    }
+    snapshot.swap(pending_);
+    has_pending_ = false;
+    is_writing_ = true;
+    lock.unlock();
+    WriteFile(snapshot);
+    lock.lock();
+    is_writing_ = false;
+    // Wakes Flush() once nothing more is pending.
+    cv_.notify_all();
+  }
+}
+
+bool Checkpointer::WriteFile(const std::string& snapshot) {
+  const std::string tmp_path = path_ + ".tmp";
+  const int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    std::cerr << "Checkpointer::WriteFile cannot create " << tmp_path << std::endl;
+    return false;
+  }
+  size_t written = 0;
+  while (written < snapshot.size()) {
+    const ssize_t n = write(fd, snapshot.data() + written, snapshot.size() - written);
+    if (n <= 0) {
+      break;
+    }
+    written += n;
+  }
+  // The data must be durable before the rename makes it the checkpoint.
+  const bool is_synced = written == snapshot.size() && fsync(fd) == 0;
+  close(fd);
+  if (!is_synced) {
+    std::cerr << "Checkpointer::WriteFile failed to write " << tmp_path << std::endl;
+    return false;
+  }
+  if (rename(tmp_path.c_str(), path_.c_str()) != 0) {
+    std::cerr << "Checkpointer::WriteFile failed to rename " << tmp_path
+              << " to " << path_ << std::endl;
+    return false;
+  }
+  // Persist the rename itself.
+  const size_t slash = path_.rfind('/');
+  const std::string directory = slash == std::string::npos ? "." :
+      slash == 0 ? "/" : path_.substr(0, slash);
+  const int directory_fd = open(directory.c_str(), O_RDONLY);
+  if (directory_fd >= 0) {
+    fsync(directory_fd);
+    close(directory_fd);
+  }
+  return true;
+}
+
+bool ReadCheckpointFile(const std::string& path, std::string* contents) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in) {
+    return false;
+  }
+  std::ostringstream oss;
+  oss << in.rdbuf();
+  *contents = oss.str();
+  return true;
+}
+
+}  // namespace sampler
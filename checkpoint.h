@@ -0,0 +1,108 @@
+#ifndef SAMPLER_CHECKPOINT_H_
+#define SAMPLER_CHECKPOINT_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace sampler {
+
+// Appends fixed-width binary fields, in host byte order, to a string.
+// Checkpoints are only meant to be restored by the same build.
+class StateWriter {
+  public:
+  explicit StateWriter(std::string* out);
+  void WriteInt64(int64_t value);
+  void WriteDouble(double value);
+  void WriteString(const std::string& value);
+  void WriteDoubles(const std::vector<double>& values);
+  void WriteInts(const std::vector<int>& values);
+
+  private:
+  void WriteBytes(const void* data, size_t num_bytes);
+  std::string* out_;
+};
+
+// Reads fields in the order StateWriter wrote them. Every Read* returns
+// false once the input is exhausted or malformed, and keeps doing so.
+class StateReader {
+  public:
+  explicit StateReader(const std::string& in);
+  bool ReadInt64(int64_t* value);
+  bool ReadDouble(double* value);
+  bool ReadString(std::string* value);
+  bool ReadDoubles(std::vector<double>* values);
+  bool ReadInts(std::vector<int>* values);
+  bool AtEnd() const;
+
+  private:
+  bool ReadBytes(void* data, size_t num_bytes);
+  const std::string& in_;
+  size_t pos_;
+  bool ok_;
+};
+
+// Serializes any standard random engine or distribution through its
+// stream operators, which the standard guarantees round-trip exactly.
+template <typename T>
+void WriteRandomState(const T& state, StateWriter* writer) {
+  std::ostringstream oss;
+  oss.precision(17);
+  oss << state;
+  writer->WriteString(oss.str());
+}
+
+template <typename T>
+bool ReadRandomState(StateReader* reader, T* state) {
+  std::string serialized;
+  if (!reader->ReadString(&serialized)) {
+    return false;
+  }
+  std::istringstream iss(serialized);
+  iss >> *state;
+  return !iss.fail();
+}
+
+// Writes snapshots to path on a thread of its own rather than as a
+// Scheduler task, so file I/O never holds up a worker that sampling is
+// waiting for. The file is replaced atomically
+// (write and fsync path.tmp, then rename), so a crash mid-write leaves the
+// previous checkpoint intact.
+class Checkpointer {
+  public:
+  explicit Checkpointer(const std::string& path);
+  // Writes the pending snapshot, if any, then stops the writer thread.
+  ~Checkpointer();
+
+  // Takes snapshot by value so the caller only pays for a move. If the
+  // previous write is still running, this snapshot replaces any one already
+  // waiting behind it; checkpoints are never queued up unboundedly.
+  void WriteAsync(std::string snapshot);
+  // Blocks until every snapshot passed to WriteAsync() is on disk.
+  void Flush();
+  const std::string& GetPath() const;
+
+  private:
+  void WriterLoop();
+  bool WriteFile(const std::string& snapshot);
+
+  std::string path_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::string pending_;
+  bool has_pending_;
+  bool is_writing_;
+  bool stopping_;
+  std::thread writer_;
+};
+
+// Reads a whole checkpoint file into contents.
+bool ReadCheckpointFile(const std::string& path, std::string* contents);
+
+}  // namespace sampler
+
+#endif  // SAMPLER_CHECKPOINT_H_
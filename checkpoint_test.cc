@@ -0,0 +1,159 @@
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "checkpoint.h"
+#include "framework.h"
+#include "test_util.h"
+
+namespace {
+
+// Exercises every kind of saved state: scalar Metropolis on Gaussian and
+// uniform nodes, Gibbs on a discrete node, an adaptive block and an exact
+// Gaussian block, plus the Worker's accumulators.
+MetroSampler* BuildModel() {
+  MetroSampler* sampler = new MetroSampler(new GaussianProposalDensity1D(0.5));
+  sampler->SetVerbose(false);
+
+  Node* x = new GaussianNode({0.0}, 1.0, "x");
+  Node* u = new UniformNode(0.0, 2.0, "u");
+  Node* y = new GaussianNode({0.0, 1.0, 1.0}, 0.5, "y");
+  Node* z = new GaussianEvidenceNode({0.0, 1.0}, 0.5, 3.0, "z");
+  y->EdgeFrom(x);
+  y->EdgeFrom(u);
+  z->EdgeFrom(y);
+
+  Node* a = new DiscreteNode(2, {0.3, 0.7}, "a");
+  Node* b = new DiscreteEvidenceNode(2, {0.9, 0.1, 0.2, 0.8}, 1, "b");
+  b->EdgeFrom(a);
+
+  Node* w1 = new GaussianNode({0.0}, 1.0, "w1");
+  Node* w2 = new GaussianNode({0.0, 0.9}, 0.2, "w2");
+  Node* w3 = new GaussianEvidenceNode({0.0, 1.0}, 0.2, 1.0, "w3");
+  w2->EdgeFrom(w1);
+  w3->EdgeFrom(w2);
+
+  Node* e = new GaussianNode({1.0}, 2.0, "e");
+  Node* f = new GaussianEvidenceNode({0.0, 2.0}, 1.0, 4.0, "f");
+  f->EdgeFrom(e);
+
+  const int x_idx = sampler->Register(x);
+  for (Node* node : {u, y, z, a, b}) {
+    sampler->Register(node);
+  }
+  const int w1_idx = sampler->Register(w1);
+  const int w2_idx = sampler->Register(w2);
+  sampler->Register(w3);
+  const int e_idx = sampler->Register(e);
+  sampler->Register(f);
+
+  sampler->AddBlock({w1_idx, w2_idx}, new GaussianProposalDensityND(2, 0.1));
+  sampler->SetAdaptationIterations(400);
+  sampler->AddExactGaussianBlock({e_idx});
+  sampler->Register(new HistogramWorker(-3.0, 3.0, 30, x_idx));
+  return sampler;
+}
+
+std::vector<double> GetValues(Sampler* sampler) {
+  std::vector<double> values;
+  for (int i = 0; i < sampler->GetNumNodes(); ++i) {
+    values.push_back(sampler->GetNode(i)->GetValue());
+  }
+  return values;
+}
+
+std::string TempPath(const std::string& name) {
+  const char* directory = getenv("TEST_TMPDIR");
+  return std::string(directory != nullptr ? directory : "/tmp") + "/" + name;
+}
+
+void TestStateRoundTrip() {
+  std::string state;
+  sampler::StateWriter writer(&state);
+  writer.WriteInt64(-42);
+  writer.WriteDouble(0.1);
+  writer.WriteString("hopper");
+  writer.WriteDoubles({1.5, -2.5});
+  writer.WriteInts({3, 4, 5});
+
+  sampler::StateReader reader(state);
+  int64_t int_value = 0;
+  double double_value = 0.0;
+  std::string string_value;
+  std::vector<double> doubles;
+  std::vector<int> ints;
+  EXPECT_TRUE(reader.ReadInt64(&int_value) && int_value == -42);
+  EXPECT_TRUE(reader.ReadDouble(&double_value) && double_value == 0.1);
+  EXPECT_TRUE(reader.ReadString(&string_value) && string_value == "hopper");
+  EXPECT_TRUE(reader.ReadDoubles(&doubles) && doubles == std::vector<double>({1.5, -2.5}));
+  EXPECT_TRUE(reader.ReadInts(&ints) && ints == std::vector<int>({3, 4, 5}));
+  EXPECT_TRUE(reader.AtEnd());
+  EXPECT_TRUE(!reader.ReadInt64(&int_value));
+}
+
+void TestRestoreContinuesIdentically() {
+  std::unique_ptr<MetroSampler> original(BuildModel());
+  original->Reset();
+  original->Infer(300);
+  const std::string snapshot = original->Snapshot();
+  original->Infer(200);
+
+  std::unique_ptr<MetroSampler> restored(BuildModel());
+  EXPECT_TRUE(restored->Restore(snapshot));
+  EXPECT_TRUE(restored->GetNumSweeps() == 300);
+  EXPECT_TRUE(restored->GetSeed() == original->GetSeed());
+  restored->Infer(200);
+
+  EXPECT_TRUE(GetValues(restored.get()) == GetValues(original.get()));
+  EXPECT_TRUE(restored->GetWorker()->ToJsonString() == original->GetWorker()->ToJsonString());
+  EXPECT_TRUE(restored->GetAcceptanceRate() == original->GetAcceptanceRate());
+  EXPECT_TRUE(restored->Snapshot() == original->Snapshot());
+}
+
+void TestRestoreRejectsOtherModels() {
+  std::unique_ptr<MetroSampler> original(BuildModel());
+  original->Reset();
+  original->Infer(10);
+  const std::string snapshot = original->Snapshot();
+
+  std::unique_ptr<MetroSampler> larger(BuildModel());
+  larger->Register(new GaussianNode({0.0}, 1.0));
+  EXPECT_TRUE(!larger->Restore(snapshot));
+
+  std::unique_ptr<MetroSampler> same(BuildModel());
+  EXPECT_TRUE(!same->Restore(snapshot.substr(0, snapshot.size() / 2)));
+  EXPECT_TRUE(!same->Restore(snapshot + "x"));
+}
+
+void TestCheckpointFile() {
+  const std::string path = TempPath("checkpoint_test.ckpt");
+  std::unique_ptr<MetroSampler> original(BuildModel());
+  original->Reset();
+  original->EnableCheckpoints(path, 100);
+  original->Infer(300);
+  original->FlushCheckpoints();
+  // The last checkpoint fell due on the final sweep, so the file holds the
+  // current state.
+  std::string contents;
+  EXPECT_TRUE(sampler::ReadCheckpointFile(path, &contents));
+  EXPECT_TRUE(contents == original->Snapshot());
+  original->EnableCheckpoints(path, 0);
+  original->Infer(100);
+
+  std::unique_ptr<MetroSampler> restored(BuildModel());
+  EXPECT_TRUE(restored->RestoreFromFile(path));
+  restored->Infer(100);
+  EXPECT_TRUE(GetValues(restored.get()) == GetValues(original.get()));
+  remove(path.c_str());
+}
+
+}  // namespace
+
+int main() {
+  TestStateRoundTrip();
+  TestRestoreContinuesIdentically();
+  TestRestoreRejectsOtherModels();
+  TestCheckpointFile();
+  return sampler::testing::TestResult();
+}
@@ -0,0 +1,263 @@
+#include <iostream>
+#include <set>
+
+#include "exact_gaussian.h"
+#include "linalg.h"
+
+namespace sampler {
+
+bool GaussianSubnetwork::IsLinearGaussian(const std::vector<Node*>& nodes) {
+  if (nodes.empty()) {
+    std::cerr << "GaussianSubnetwork::IsLinearGaussian no nodes" << std::endl;
+    return false;
+  }
+  for (Node* node : nodes) {
+    if (node->IsEvidence() || dynamic_cast<GaussianNode*>(node) == nullptr) {
+      std::cerr << "GaussianSubnetwork::IsLinearGaussian node [" << node->GetName()
+                << "] is not a latent GaussianNode" << std::endl;
+      return false;
+    }
+    for (Node* child : node->GetChildren()) {
+      if (dynamic_cast<GaussianNode*>(child) == nullptr) {
+        std::cerr << "GaussianSubnetwork::IsLinearGaussian child [" << child->GetName()
+                  << "] of [" << node->GetName() << "] is not a GaussianNode" << std::endl;
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+GaussianSubnetwork::GaussianSubnetwork(const std::vector<Node*>& nodes,
+                                       double evidence_inverse_temperature) :
+  nodes_(nodes),
+  evidence_inverse_temperature_(evidence_inverse_temperature),
+  is_valid_(false),
+  buffer_(nodes.size()),
+  standard_normal_(1.0)
+{
+  std::map<Node*, int> latent_idx;
+  for (int i = 0; i < nodes_.size(); ++i) {
+    latent_idx[nodes_[i]] = i;
+  }
+  // Every factor that mentions a latent node: the latent nodes' own
+  // conditionals, then those of their children in graph order. The order
+  // fixes the summation order of the precision matrix, so it must not
+  // depend on pointer values; the set only drops repeats.
+  std::vector<Node*> factor_nodes(nodes_);
+  std::set<Node*> seen(nodes_.begin(), nodes_.end());
+  for (Node* node : nodes_) {
+    for (Node* child : node->GetChildren()) {
+      if (seen.insert(child).second) {
+        factor_nodes.push_back(child);
+      }
+    }
+  }
+  for (Node* node : factor_nodes) {
+    AddFactor(static_cast<GaussianNode*>(node), latent_idx);
+  }
+  Factorize();
+}
+
+void GaussianSubnetwork::SetEvidenceInverseTemperature(double evidence_inverse_temperature) {
+  if (evidence_inverse_temperature == evidence_inverse_temperature_) {
+    return;
+  }
+  evidence_inverse_temperature_ = evidence_inverse_temperature;
+  Factorize();
+}
+
+void GaussianSubnetwork::Factorize() {
+  const int dim = nodes_.size();
+  cholesky_.assign(dim * dim, 0.0);
+  for (const Factor& factor : factors_) {
+    const double weight = factor.is_evidence ?
+        evidence_inverse_temperature_ * factor.inv_sigma2 : factor.inv_sigma2;
+    for (const auto& row : factor.latent_terms) {
+      for (const auto& col : factor.latent_terms) {
+        cholesky_[row.first * dim + col.first] += weight * row.second * col.second;
+      }
+    }
+  }
+  is_valid_ = CholeskyDecompose(dim, &cholesky_);
+  if (!is_valid_) {
+    std::cerr << "GaussianSubnetwork precision matrix is not positive definite" << std::endl;
+  }
+}
+
+void GaussianSubnetwork::AddFactor(GaussianNode* node, const std::map<Node*, int>& latent_idx) {
+  Factor factor;
+  factor.offset = node->GetBeta()[0];
+  factor.inv_sigma2 = 1.0 / node->GetSigma2();
+  factor.is_evidence = node->IsEvidence();
+
+  std::map<Node*, int>::const_iterator self = latent_idx.find(node);
+  if (self != latent_idx.end()) {
+    factor.latent_terms.push_back(std::make_pair(self->second, 1.0));
+  } else {
+    factor.boundary_terms.push_back(std::make_pair(static_cast<Node*>(node), 1.0));
+  }
+  const std::vector<Node*>& parents = node->GetParents();
+  for (int i = 0; i < parents.size(); ++i) {
+    const double beta = node->GetBeta()[i + 1];
+    std::map<Node*, int>::const_iterator parent = latent_idx.find(parents[i]);
+    if (parent != latent_idx.end()) {
+      factor.latent_terms.push_back(std::make_pair(parent->second, -beta));
+    } else {
+      factor.boundary_terms.push_back(std::make_pair(parents[i], -beta));
+    }
+  }
+  factors_.push_back(factor);
+}
+
+bool GaussianSubnetwork::IsValid() const {
+  return is_valid_;
+}
+
+int GaussianSubnetwork::GetDimension() const {
+  return nodes_.size();
+}
+
+const std::vector<Node*>& GaussianSubnetwork::GetNodes() const {
+  return nodes_;
+}
+
+void GaussianSubnetwork::ComputeMean(std::vector<double>* mean) const {
+  const int dim = nodes_.size();
+  // Each factor contributes (c_f / sigma2_f) * a_f to the information vector,
+  // where c_f moves the constant and boundary parts of the residual across.
+  mean->assign(dim, 0.0);
+  for (const Factor& factor : factors_) {
+    double constant = factor.offset;
+    for (const auto& term : factor.boundary_terms) {
+      constant -= term.second * term.first->GetValue();
+    }
+    const double weight = factor.is_evidence ?
+        evidence_inverse_temperature_ * factor.inv_sigma2 : factor.inv_sigma2;
+    for (const auto& term : factor.latent_terms) {
+      (*mean)[term.first] += weight * constant * term.second;
+    }
+  }
+  SolveLower(dim, cholesky_, mean);
+  SolveLowerTransposed(dim, cholesky_, mean);
+}
+
+void GaussianSubnetwork::ComputeCovariance(std::vector<double>* covariance) const {
+  const int dim = nodes_.size();
+  covariance->assign(dim * dim, 0.0);
+  for (int col = 0; col < dim; ++col) {
+    buffer_.assign(dim, 0.0);
+    buffer_[col] = 1.0;
+    SolveLower(dim, cholesky_, &buffer_);
+    SolveLowerTransposed(dim, cholesky_, &buffer_);
+    for (int row = 0; row < dim; ++row) {
+      (*covariance)[row * dim + col] = buffer_[row];
+    }
+  }
+}
+
+void GaussianSubnetwork::Sample() {
+  const int dim = nodes_.size();
+  std::vector<double> mean;
+  ComputeMean(&mean);
+  // With Lambda = L L^T, L^-T z has covariance Lambda^-1.
+  for (int i = 0; i < dim; ++i) {
+    buffer_[i] = standard_normal_.Draw();
+  }
+  SolveLowerTransposed(dim, cholesky_, &buffer_);
+  for (int i = 0; i < dim; ++i) {
+    nodes_[i]->SetValue(mean[i] + buffer_[i]);
+  }
+}
+
+void GaussianSubnetwork::Seed(uint64_t seed) {
+  standard_normal_.Seed(seed);
+}
+
+void GaussianSubnetwork::SaveState(StateWriter* writer) const {
+  standard_normal_.SaveState(writer);
+}
+
+bool GaussianSubnetwork::LoadState(StateReader* reader) {
+  return standard_normal_.LoadState(reader);
+}
+
+}  // namespace sampler
+
+ExactGaussianEngine::ExactGaussianEngine() :
+  is_compiled_(false)
+{}
+
+bool ExactGaussianEngine::Compile() {
+  subnetwork_.reset();
+  is_compiled_ = false;
+  if (!sampler::GaussianSubnetwork::IsLinearGaussian(NonEvidenceNodes())) {
+    return false;
+  }
+  subnetwork_.reset(new sampler::GaussianSubnetwork(NonEvidenceNodes(), GetInverseTemperature()));
+  subnetwork_->Seed(GetEngineSeed());
+  is_compiled_ = subnetwork_->IsValid();
+  return is_compiled_;
+}
+
+void ExactGaussianEngine::Infer(int num_iterations) {
+  if (IsVerbose()) {
+    std::cerr << "ExactGaussianEngine::Infer going for " << num_iterations << " iterations" << std::endl;
+  }
+  if (!is_compiled_ && !Compile()) {
+    std::cerr << "ExactGaussianEngine::Infer network is not linear-Gaussian" << std::endl;
+    return;
+  }
+  for (int i = 0; i < num_iterations; ++i) {
+    subnetwork_->Sample();
+    if (!EndSweep()) {
+      if (IsVerbose()) {
+        std::cerr << "ExactGaussianEngine::Infer cancelled after " << i + 1 << " iterations" << std::endl;
+      }
+      break;
+    }
+  }
+  if (IsVerbose()) {
+    std::cerr << "ExactGaussianEngine::Infer done" << std::endl;
+  }
+}
+
+bool ExactGaussianEngine::GetPosteriorMean(std::vector<double>* mean) {
+  if (!is_compiled_ && !Compile()) {
+    return false;
+  }
+  subnetwork_->ComputeMean(mean);
+  return true;
+}
+
+bool ExactGaussianEngine::GetPosteriorCovariance(std::vector<double>* covariance) {
+  if (!is_compiled_ && !Compile()) {
+    return false;
+  }
+  subnetwork_->ComputeCovariance(covariance);
+  return true;
+}
+
+void ExactGaussianEngine::SeedEngine(uint64_t engine_seed) {
+  if (subnetwork_) {
+    subnetwork_->Seed(engine_seed);
+  }
+}
+
+void ExactGaussianEngine::SaveEngineState(sampler::StateWriter* writer) const {
+  writer->WriteInt64(is_compiled_);
+  if (is_compiled_) {
+    subnetwork_->SaveState(writer);
+  }
+}
+
+bool ExactGaussianEngine::LoadEngineState(sampler::StateReader* reader) {
+  int64_t is_compiled = 0;
+  if (!reader->ReadInt64(&is_compiled)) {
+    return false;
+  }
+  if (!is_compiled) {
+    return true;
+  }
+  return (is_compiled_ || Compile()) && subnetwork_->LoadState(reader);
+}
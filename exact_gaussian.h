@@ -0,0 +1,106 @@
+#ifndef SAMPLER_EXACT_GAUSSIAN_H_
+#define SAMPLER_EXACT_GAUSSIAN_H_
+
+#include <map>
+#include <vector>
+
+#include "framework.h"
+
+namespace sampler {
+
+// Exact conditional distribution of a set of non-evidence GaussianNodes
+// given the current values of every other node. When each latent node is a
+// linear function of its parents plus Gaussian noise, and each of their
+// children is a GaussianNode too, that conditional is a multivariate
+// Gaussian with precision
+//   Lambda = sum_f a_f a_f^T / sigma2_f
+// over the factors f touching the set, where a_f holds the coefficients
+// of the latent values in factor f's residual. Lambda depends only on the
+// betas, variances and tempering, so it is assembled and factorized once.
+// Each update only rebuilds the information vector from the boundary
+// values.
+class GaussianSubnetwork {
+  public:
+  // Whether GaussianSubnetwork can be built for nodes; logs the reason if not.
+  static bool IsLinearGaussian(const std::vector<Node*>& nodes);
+
+  // nodes must satisfy IsLinearGaussian(). Factors of evidence nodes are
+  // weighted by evidence_inverse_temperature, as in a tempered MetroSampler.
+  explicit GaussianSubnetwork(const std::vector<Node*>& nodes,
+                              double evidence_inverse_temperature = 1.0);
+
+  // Reweights the evidence factors and refactorizes.
+  void SetEvidenceInverseTemperature(double evidence_inverse_temperature);
+
+  // False if the precision matrix was not positive definite, e.g. when a
+  // latent node has zero variance.
+  bool IsValid() const;
+  int GetDimension() const;
+  const std::vector<Node*>& GetNodes() const;
+
+  // Mean given the current boundary values, in GetNodes() order.
+  void ComputeMean(std::vector<double>* mean) const;
+  // Row-major covariance; independent of boundary values.
+  void ComputeCovariance(std::vector<double>* covariance) const;
+  // Sets every node to a joint exact draw from the conditional.
+  void Sample();
+  void Seed(uint64_t seed);
+
+  void SaveState(StateWriter* writer) const;
+  bool LoadState(StateReader* reader);
+
+  private:
+  struct Factor {
+    // Latent coefficients of the residual x_f - beta_0 - sum_j beta_j x_j.
+    std::vector<std::pair<int, double>> latent_terms;
+    // Nodes outside the set whose current value enters the residual.
+    std::vector<std::pair<Node*, double>> boundary_terms;
+    double offset;
+    double inv_sigma2;
+    bool is_evidence;
+  };
+
+  void AddFactor(GaussianNode* node, const std::map<Node*, int>& latent_idx);
+  void Factorize();
+
+  std::vector<Node*> nodes_;
+  std::vector<Factor> factors_;
+  // Lower triangular Cholesky factor of the precision matrix.
+  std::vector<double> cholesky_;
+  double evidence_inverse_temperature_;
+  bool is_valid_;
+  mutable std::vector<double> buffer_;
+  GaussianSource standard_normal_;
+};
+
+}  // namespace sampler
+
+// Exact inference for networks whose non-evidence nodes are all linear
+// GaussianNodes. Infer() draws independent exact posterior samples and
+// feeds them to the Worker, so one factorization replaces burn-in and
+// mixing. Evidence values may change between Infer() calls (e.g. in a
+// BatchQueryRunner) without refactorizing.
+class ExactGaussianEngine : public Sampler {
+  private:
+  std::unique_ptr<sampler::GaussianSubnetwork> subnetwork_;
+  bool is_compiled_;
+
+  protected:
+  void SeedEngine(uint64_t engine_seed) override;
+  void SaveEngineState(sampler::StateWriter* writer) const override;
+  bool LoadEngineState(sampler::StateReader* reader) override;
+
+  public:
+  ExactGaussianEngine();
+  // Assembles and factorizes the posterior precision; call after every
+  // node is registered. Infer() calls it on first use. Returns false if
+  // the network is not linear-Gaussian.
+  bool Compile();
+  void Infer(int num_iterations) override;
+
+  // Posterior moments of the non-evidence nodes, in registration order.
+  bool GetPosteriorMean(std::vector<double>* mean);
+  bool GetPosteriorCovariance(std::vector<double>* covariance);
+};
+
+#endif  // SAMPLER_EXACT_GAUSSIAN_H_
@@ -0,0 +1,99 @@
+#include <memory>
+#include <vector>
+
+#include "exact_gaussian.h"
+#include "framework.h"
+#include "shared_posterior.h"
+#include "test_util.h"
+
+namespace {
+
+// x ~ N(0, 1), y | x ~ N(2 + x / 2, 1 / 4), z | y ~ N(y - 1, 1 / 2), z = 2.
+// Conditioning the joint Gaussian on z gives
+//   E[x, y | z] = (1 / 2, 5 / 2),
+//   Var[x] = 3 / 4, Cov[x, y] = 1 / 4, Var[y] = 1 / 4.
+const double kMean[] = {0.5, 2.5};
+const double kCovariance[] = {0.75, 0.25, 0.25, 0.25};
+
+// Registers x, y, z in that order and returns x's index.
+int AddChain(Sampler* sampler) {
+  Node* x = new GaussianNode({0.0}, 1.0, "x");
+  Node* y = new GaussianNode({2.0, 0.5}, 0.25, "y");
+  Node* z = new GaussianEvidenceNode({-1.0, 1.0}, 0.5, 2.0, "z");
+  y->EdgeFrom(x);
+  z->EdgeFrom(y);
+  const int x_idx = sampler->Register(x);
+  sampler->Register(y);
+  sampler->Register(z);
+  return x_idx;
+}
+
+void ExpectMomentsOfX(Sampler* sampler, int num_iterations) {
+  sampler::PosteriorSummary summary;
+  EXPECT_TRUE(sampler->GetWorker()->GetSummary(&summary));
+  EXPECT_TRUE(summary.num_samples == num_iterations);
+  EXPECT_NEAR(summary.mean, kMean[0], 0.03);
+  EXPECT_NEAR(summary.variance, kCovariance[0], 0.05);
+}
+
+void TestClosedForm() {
+  ExactGaussianEngine engine;
+  engine.SetVerbose(false);
+  AddChain(&engine);
+  EXPECT_TRUE(engine.Compile());
+
+  std::vector<double> mean;
+  std::vector<double> covariance;
+  EXPECT_TRUE(engine.GetPosteriorMean(&mean));
+  EXPECT_TRUE(engine.GetPosteriorCovariance(&covariance));
+  EXPECT_TRUE(mean.size() == 2 && covariance.size() == 4);
+  for (int i = 0; i < 2 && i < mean.size(); ++i) {
+    EXPECT_NEAR(mean[i], kMean[i], 1e-12);
+  }
+  for (int i = 0; i < 4 && i < covariance.size(); ++i) {
+    EXPECT_NEAR(covariance[i], kCovariance[i], 1e-12);
+  }
+}
+
+void TestEngineSamples() {
+  const int kNumIterations = 20000;
+  ExactGaussianEngine engine;
+  engine.SetVerbose(false);
+  const int x_idx = AddChain(&engine);
+  engine.Register(new HistogramWorker(-4.0, 4.0, 40, x_idx));
+  engine.Infer(kNumIterations);
+  ExpectMomentsOfX(&engine, kNumIterations);
+}
+
+void TestMetroSamplerExactBlock() {
+  const int kNumIterations = 20000;
+  MetroSampler sampler(new GaussianProposalDensity1D(0.5));
+  sampler.SetVerbose(false);
+  const int x_idx = AddChain(&sampler);
+  EXPECT_TRUE(sampler.AddExactGaussianBlock({x_idx, x_idx + 1}));
+  sampler.Register(new HistogramWorker(-4.0, 4.0, 40, x_idx));
+  sampler.Reset();
+  sampler.Infer(kNumIterations);
+  ExpectMomentsOfX(&sampler, kNumIterations);
+}
+
+void TestRejectsNonlinearNetworks() {
+  ExactGaussianEngine engine;
+  engine.SetVerbose(false);
+  Node* u = new UniformNode(0.0, 1.0, "u");
+  Node* y = new GaussianEvidenceNode({0.0, 1.0}, 1.0, 0.5, "y");
+  y->EdgeFrom(u);
+  engine.Register(u);
+  engine.Register(y);
+  EXPECT_TRUE(!engine.Compile());
+}
+
+}  // namespace
+
+int main() {
+  TestClosedForm();
+  TestEngineSamples();
+  TestMetroSamplerExactBlock();
+  TestRejectsNonlinearNetworks();
+  return sampler::testing::TestResult();
+}
@@ -1,16 +1,59 @@
+#include <algorithm>
+#include <atomic>
 #include <cmath>
 #include <iostream>
+#include <limits>
+#include <set>
+#include "exact_gaussian.h"
 #include "framework.h"
+#include "linalg.h"
+
+// Sweeps between covariance updates of adaptive block proposals.
+static const int kAdaptationInterval = 50;
 
 static double Gaussian(double x, double half_inv_sigma2) {
   return exp(-x * x * half_inv_sigma2);
 }
 
-static double NormUniformDraw() {
-  return double(rand()) / double(RAND_MAX); 
+// Number of doubles in the smallest whole number of cache lines holding n.
+static int RoundUpToCacheLine(int n) {
+  const int doubles_per_line = sampler::kCacheLineSize / sizeof(double);
+  return (n + doubles_per_line - 1) / doubles_per_line * doubles_per_line;
 }
 
+// Leading field of every Sampler::Snapshot(); bump when the layout changes.
+static const char kSnapshotMagic[] = "hopper-checkpoint-2";
+
+// Seed of the first Sampler; later ones derive theirs from it in
+// construction order.
+static const uint64_t kDefaultSeed = 5489;
+static std::atomic<uint64_t> num_samplers_constructed(0);
+
+// Streams of DeriveSeed(Sampler seed, .): one family for the nodes, one
+// for the engine.
+static const uint64_t kNodeStreams = 0;
+static const uint64_t kEngineStreams = 1;
+
+// Streams of DeriveSeed(MetroSampler engine seed, .).
+static const uint64_t kAcceptanceStream = 0;
+static const uint64_t kScalarProposalStream = 1;
+static const uint64_t kBlockStreams = 2;
+static const uint64_t kExactBlockStreams = 3;
+
+namespace sampler {
+
+uint64_t DeriveSeed(uint64_t seed, uint64_t stream) {
+  // SplitMix64 output function over a Weyl step per stream.
+  uint64_t z = seed + 0x9e3779b97f4a7c15ULL * (stream + 1);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+}  // namespace sampler
+
 Node::Node(const std::string& debug_name) :
+  value_(0.0),
   debug_name_(debug_name)
 {
   ClearEvidence();
@@ -86,6 +129,243 @@ void Node::EdgeFrom(Node* from) {
   from->AddChild(this);
 }
 
+double Node::GetLogConditional() const {
+  return log(GetConditional());
+}
+
+void Node::SaveState(sampler::StateWriter* writer) const {
+  writer->WriteDouble(value_);
+  writer->WriteInt64(is_initialized_);
+}
+
+bool Node::LoadState(sampler::StateReader* reader) {
+  int64_t is_initialized = 0;
+  if (!reader->ReadDouble(&value_) || !reader->ReadInt64(&is_initialized)) {
+    return false;
+  }
+  is_initialized_ = is_initialized;
+  return true;
+}
+
+void Node::AddLogConditionalsOverParentStates(Node* parent,
+                                              int num_states,
+                                              double* log_densities) const {
+  const double original = parent->GetValue();
+  for (int state = 0; state < num_states; ++state) {
+    parent->SetValue(state);
+    log_densities[state] += GetLogConditional();
+  }
+  parent->SetValue(original);
+}
+
+DiscreteNode::DiscreteNode(int num_states, const std::vector<double>& cpt, const std::string& debug_name) :
+  Node(debug_name),
+  num_states_(num_states),
+  row_stride_(RoundUpToCacheLine(num_states)),
+  log_densities_(row_stride_, 0.0),
+  evidence_log_densities_(row_stride_, 0.0),
+  num_cached_parents_(-1),
+  is_valid_(false),
+  has_whole_rows_(true)
+{
+  const int num_rows = num_states_ > 0 ? cpt.size() / num_states_ : 0;
+  if (num_rows == 0 || num_rows * num_states_ != cpt.size()) {
+    std::cerr << "DiscreteNode [" << debug_name << "] table size " << cpt.size()
+              << " is not a positive multiple of " << num_states_ << " states" << std::endl;
+    has_whole_rows_ = false;
+  }
+  cpt_.assign(num_rows * row_stride_, 0.0);
+  log_cpt_.assign(num_rows * row_stride_, 0.0);
+  for (int row = 0; row < num_rows; ++row) {
+    for (int state = 0; state < num_states_; ++state) {
+      cpt_[row * row_stride_ + state] = cpt[row * num_states_ + state];
+      log_cpt_[row * row_stride_ + state] = log(cpt[row * num_states_ + state]);
+    }
+  }
+}
+
+const std::vector<int>& DiscreteNode::GetParentStrides() const {
+  const std::vector<Node*>& parents = GetParents();
+  if (num_cached_parents_ != parents.size()) {
+    num_cached_parents_ = parents.size();
+    parent_strides_.resize(parents.size());
+    is_valid_ = has_whole_rows_;
+    int stride = 1;
+    for (int i = parents.size() - 1; i >= 0; --i) {
+      parent_strides_[i] = stride;
+      const DiscreteNode* parent = dynamic_cast<const DiscreteNode*>(parents[i]);
+      if (parent == nullptr) {
+        std::cerr << "DiscreteNode [" << GetName() << "] parent [" << parents[i]->GetName()
+                  << "] is not discrete" << std::endl;
+        is_valid_ = false;
+        continue;
+      }
+      stride *= parent->GetNumStates();
+    }
+    if (has_whole_rows_ && stride * row_stride_ != cpt_.size()) {
+      std::cerr << "DiscreteNode [" << GetName() << "] table has " << cpt_.size() / row_stride_
+                << " rows but parents have " << stride << " configurations" << std::endl;
+      is_valid_ = false;
+    }
+  }
+  return parent_strides_;
+}
+
+bool DiscreteNode::IsValid() const {
+  GetParentStrides();
+  return is_valid_;
+}
+
+int DiscreteNode::GetNumStates() const {
+  return num_states_;
+}
+
+bool DiscreteNode::HasValidState() const {
+  const double value = GetValue();
+  return value >= 0.0 && value < num_states_ && value == static_cast<int>(value);
+}
+
+int DiscreteNode::GetState() const {
+  return GetValue();
+}
+
+int DiscreteNode::GetParentConfiguration() const {
+  const std::vector<int>& strides = GetParentStrides();
+  const std::vector<Node*>& parents = GetParents();
+  int configuration = 0;
+  for (int i = 0; i < parents.size(); ++i) {
+    configuration += strides[i] * int(parents[i]->GetValue());
+  }
+  return configuration;
+}
+
+double DiscreteNode::GetConditional() const {
+  if (!IsValid()) {
+    return 0.0;
+  }
+  return cpt_[GetParentConfiguration() * row_stride_ + GetState()];
+}
+
+double DiscreteNode::GetLogConditional() const {
+  if (!IsValid()) {
+    return -std::numeric_limits<double>::infinity();
+  }
+  return log_cpt_[GetParentConfiguration() * row_stride_ + GetState()];
+}
+
+double DiscreteNode::GetSample() {
+  if (!IsValid()) {
+    return GetValue();
+  }
+  const double* row = &cpt_[GetParentConfiguration() * row_stride_];
+  double u = uniform_source_.Draw();
+  int state = 0;
+  for (; state < num_states_ - 1; ++state) {
+    u -= row[state];
+    if (u < 0.0) {
+      break;
+    }
+  }
+  return state;
+}
+
+void DiscreteNode::Seed(uint64_t seed) {
+  uniform_source_.Seed(seed);
+}
+
+void DiscreteNode::SaveState(sampler::StateWriter* writer) const {
+  Node::SaveState(writer);
+  uniform_source_.SaveState(writer);
+}
+
+bool DiscreteNode::LoadState(sampler::StateReader* reader) {
+  return Node::LoadState(reader) && uniform_source_.LoadState(reader);
+}
+
+void DiscreteNode::AddLogConditionalsOverParentStates(Node* parent,
+                                                      int num_states,
+                                                      double* log_densities) const {
+  if (!IsValid()) {
+    for (int state = 0; state < num_states; ++state) {
+      log_densities[state] = -std::numeric_limits<double>::infinity();
+    }
+    return;
+  }
+  const std::vector<Node*>& parents = GetParents();
+  const int parent_idx = std::find(parents.begin(), parents.end(), parent) - parents.begin();
+  const int stride = GetParentStrides()[parent_idx];
+  const int base = GetParentConfiguration() - stride * int(parent->GetValue());
+  // Same column of every row the parent can select, stepping by stride rows.
+  const double* column = &log_cpt_[base * row_stride_ + GetState()];
+  const int step = stride * row_stride_;
+  for (int state = 0; state < num_states; ++state) {
+    log_densities[state] += column[state * step];
+  }
+}
+
+void DiscreteNode::GibbsStep(double evidence_inverse_temperature) {
+  if (!IsValid()) {
+    return;
+  }
+  double* log_densities = log_densities_.data();
+  double* evidence_log_densities = evidence_log_densities_.data();
+  const double* row = &log_cpt_[GetParentConfiguration() * row_stride_];
+  for (int state = 0; state < num_states_; ++state) {
+    log_densities[state] = row[state];
+    evidence_log_densities[state] = 0.0;
+  }
+  for (Node* child : GetChildren()) {
+    const bool is_tempered = child->IsEvidence() && evidence_inverse_temperature != 1.0;
+    child->AddLogConditionalsOverParentStates(
+        this, num_states_, is_tempered ? evidence_log_densities : log_densities);
+  }
+  if (evidence_inverse_temperature != 1.0) {
+    for (int state = 0; state < num_states_; ++state) {
+      log_densities[state] += evidence_inverse_temperature * evidence_log_densities[state];
+    }
+  }
+
+  // Normalize over the contiguous row of states.
+  double max_log_density = -std::numeric_limits<double>::infinity();
+  for (int state = 0; state < num_states_; ++state) {
+    max_log_density = std::max(max_log_density, log_densities[state]);
+  }
+  if (max_log_density == -std::numeric_limits<double>::infinity()) {
+    std::cerr << "DiscreteNode::GibbsStep [" << GetName() << "] has no state with nonzero density" << std::endl;
+    return;
+  }
+  double total = 0.0;
+  for (int state = 0; state < num_states_; ++state) {
+    log_densities[state] = exp(log_densities[state] - max_log_density);
+    total += log_densities[state];
+  }
+
+  double u = uniform_source_.Draw() * total;
+  int state = 0;
+  for (; state < num_states_ - 1; ++state) {
+    u -= log_densities[state];
+    if (u < 0.0) {
+      break;
+    }
+  }
+  SetValue(state);
+}
+
+DiscreteEvidenceNode::DiscreteEvidenceNode(int num_states, const std::vector<double>& cpt, int state, const std::string& debug_name) :
+  DiscreteNode(num_states, cpt, debug_name)
+{
+  SetValue(state);
+  SetEvidence();
+  if (!HasValidState()) {
+    std::cerr << "DiscreteEvidenceNode [" << debug_name << "] state " << state
+              << " is not one of its " << num_states << " states" << std::endl;
+  }
+}
+
+double DiscreteEvidenceNode::GetSample() {
+  return GetValue();
+}
+
 ContinuousNode::ContinuousNode(const std::string& debug_name) :
   Node(debug_name)
 {}
@@ -102,6 +382,19 @@ double GaussianNode::GetConditional() const {
   return Gaussian(GetMean() - GetValue(), half_inv_sigma2_);
 }
 
+double GaussianNode::GetLogConditional() const {
+  const double residual = GetMean() - GetValue();
+  return -residual * residual * half_inv_sigma2_;
+}
+
+const std::vector<double>& GaussianNode::GetBeta() const {
+  return beta_;
+}
+
+double GaussianNode::GetSigma2() const {
+  return sigma2_;
+}
+
 double GaussianNode::GetMean() const {
   double mean = beta_[0]; 
   const std::vector<Node*> parents = GetParents();
@@ -115,6 +408,161 @@ double GaussianNode::GetSample() {
   return GetMean() + gaussian_source_.Draw();
 }
 
+void GaussianNode::Seed(uint64_t seed) {
+  gaussian_source_.Seed(seed);
+}
+
+void GaussianNode::SaveState(sampler::StateWriter* writer) const {
+  Node::SaveState(writer);
+  gaussian_source_.SaveState(writer);
+}
+
+bool GaussianNode::LoadState(sampler::StateReader* reader) {
+  return Node::LoadState(reader) && gaussian_source_.LoadState(reader);
+}
+
+ConditionalGaussianNode::ConditionalGaussianNode(const std::vector<std::vector<double>>& betas,
+                                                 const std::vector<double>& sigma2s,
+                                                 const std::string& debug_name) :
+  ContinuousNode(debug_name),
+  betas_(betas),
+  standard_normal_(1.0),
+  num_cached_parents_(-1),
+  is_valid_(false),
+  has_variance_per_beta_(betas.size() == sigma2s.size())
+{
+  if (!has_variance_per_beta_) {
+    std::cerr << "ConditionalGaussianNode [" << debug_name << "] has " << betas_.size()
+              << " betas but " << sigma2s.size() << " variances" << std::endl;
+  }
+  for (double sigma2 : sigma2s) {
+    half_inv_sigma2s_.push_back(0.5 / sigma2);
+    sigmas_.push_back(sqrt(sigma2));
+  }
+}
+
+void ConditionalGaussianNode::SplitParents() const {
+  const std::vector<Node*>& parents = GetParents();
+  if (num_cached_parents_ == parents.size()) {
+    return;
+  }
+  num_cached_parents_ = parents.size();
+  discrete_parents_.clear();
+  continuous_parents_.clear();
+  for (const Node* parent : parents) {
+    const DiscreteNode* discrete_parent = dynamic_cast<const DiscreteNode*>(parent);
+    if (discrete_parent != nullptr) {
+      discrete_parents_.push_back(discrete_parent);
+    } else {
+      continuous_parents_.push_back(parent);
+    }
+  }
+  discrete_strides_.resize(discrete_parents_.size());
+  int stride = 1;
+  for (int i = discrete_parents_.size() - 1; i >= 0; --i) {
+    discrete_strides_[i] = stride;
+    stride *= discrete_parents_[i]->GetNumStates();
+  }
+  is_valid_ = has_variance_per_beta_;
+  if (stride != betas_.size()) {
+    std::cerr << "ConditionalGaussianNode [" << GetName() << "] has " << betas_.size()
+              << " parameter sets but parents have " << stride << " configurations" << std::endl;
+    is_valid_ = false;
+  }
+  for (int configuration = 0; configuration < betas_.size(); ++configuration) {
+    if (betas_[configuration].size() != continuous_parents_.size() + 1) {
+      std::cerr << "ConditionalGaussianNode [" << GetName() << "] beta " << configuration
+                << " has " << betas_[configuration].size() << " coefficients but "
+                << continuous_parents_.size() << " continuous parents need "
+                << continuous_parents_.size() + 1 << std::endl;
+      is_valid_ = false;
+    }
+  }
+}
+
+bool ConditionalGaussianNode::IsValid() const {
+  SplitParents();
+  return is_valid_;
+}
+
+int ConditionalGaussianNode::GetConfiguration() const {
+  SplitParents();
+  int configuration = 0;
+  for (int i = 0; i < discrete_parents_.size(); ++i) {
+    configuration += discrete_strides_[i] * discrete_parents_[i]->GetState();
+  }
+  return configuration;
+}
+
+double ConditionalGaussianNode::GetMean(int configuration) const {
+  const std::vector<double>& beta = betas_[configuration];
+  double mean = beta[0];
+  for (int i = 0; i < continuous_parents_.size(); ++i) {
+    mean += beta[i + 1] * continuous_parents_[i]->GetValue();
+  }
+  return mean;
+}
+
+double ConditionalGaussianNode::GetConditional() const {
+  return exp(GetLogConditional());
+}
+
+double ConditionalGaussianNode::GetLogConditional() const {
+  if (!IsValid()) {
+    return -std::numeric_limits<double>::infinity();
+  }
+  // Unlike GaussianNode the variance varies with the configuration, so the
+  // log normalizer must be kept for discrete parents to compare states.
+  const int configuration = GetConfiguration();
+  const double residual = GetMean(configuration) - GetValue();
+  return -residual * residual * half_inv_sigma2s_[configuration] - log(sigmas_[configuration]);
+}
+
+double ConditionalGaussianNode::GetSample() {
+  if (!IsValid()) {
+    return GetValue();
+  }
+  const int configuration = GetConfiguration();
+  return GetMean(configuration) + sigmas_[configuration] * standard_normal_.Draw();
+}
+
+void ConditionalGaussianNode::Seed(uint64_t seed) {
+  standard_normal_.Seed(seed);
+}
+
+void ConditionalGaussianNode::SaveState(sampler::StateWriter* writer) const {
+  Node::SaveState(writer);
+  standard_normal_.SaveState(writer);
+}
+
+bool ConditionalGaussianNode::LoadState(sampler::StateReader* reader) {
+  return Node::LoadState(reader) && standard_normal_.LoadState(reader);
+}
+
+void ConditionalGaussianNode::AddLogConditionalsOverParentStates(Node* parent,
+                                                                 int num_states,
+                                                                 double* log_densities) const {
+  if (!IsValid()) {
+    for (int state = 0; state < num_states; ++state) {
+      log_densities[state] = -std::numeric_limits<double>::infinity();
+    }
+    return;
+  }
+  const int parent_idx = std::find(discrete_parents_.begin(), discrete_parents_.end(), parent) -
+                         discrete_parents_.begin();
+  if (parent_idx == discrete_parents_.size()) {
+    Node::AddLogConditionalsOverParentStates(parent, num_states, log_densities);
+    return;
+  }
+  const int stride = discrete_strides_[parent_idx];
+  const int base = GetConfiguration() - stride * discrete_parents_[parent_idx]->GetState();
+  for (int state = 0; state < num_states; ++state) {
+    const int configuration = base + state * stride;
+    const double residual = GetMean(configuration) - GetValue();
+    log_densities[state] += -residual * residual * half_inv_sigma2s_[configuration] - log(sigmas_[configuration]);
+  }
+}
+
 GaussianEvidenceNode::GaussianEvidenceNode(const std::vector<double>& beta, double sigma2, double value, const std::string& debug_name) :
   GaussianNode(beta, sigma2, debug_name)
 {
@@ -151,25 +599,118 @@ double UniformNode::GetConditional() const {
 }
 
 double UniformNode::GetSample() {
-  return NormUniformDraw() * (to_ - from_) + from_;
+  return uniform_source_.Draw() * (to_ - from_) + from_;
+}
+
+double UniformNode::GetFrom() const {
+  return from_;
+}
+
+double UniformNode::GetTo() const {
+  return to_;
+}
+
+void UniformNode::Seed(uint64_t seed) {
+  uniform_source_.Seed(seed);
+}
+
+void UniformNode::SaveState(sampler::StateWriter* writer) const {
+  Node::SaveState(writer);
+  uniform_source_.SaveState(writer);
 }
 
+bool UniformNode::LoadState(sampler::StateReader* reader) {
+  return Node::LoadState(reader) && uniform_source_.LoadState(reader);
+}
+
+Sampler::Sampler() :
+  is_initialized_(false),
+  scheduler_(nullptr),
+  cancellation_token_(nullptr),
+  inverse_temperature_(1.0),
+  is_verbose_(true),
+  seed_(sampler::DeriveSeed(kDefaultSeed, num_samplers_constructed++)),
+  num_sweeps_(0),
+  checkpoint_interval_(0),
+  publish_interval_(0)
+{}
+
 const std::vector<Node*>& Sampler::NonEvidenceNodes() const {
   return non_evidence_nodes_;
 }
 
+bool Sampler::HasValidDiscreteNodes() const {
+  for (const auto& node : all_nodes_) {
+    const DiscreteNode* discrete_node = dynamic_cast<const DiscreteNode*>(node.get());
+    if (discrete_node != nullptr && !discrete_node->IsValid()) {
+      std::cerr << "Sampler node [" << node->GetName()
+                << "] has a table that does not match its parents" << std::endl;
+      return false;
+    }
+    if (discrete_node != nullptr && !discrete_node->HasValidState()) {
+      std::cerr << "Sampler node [" << node->GetName() << "] value " << node->GetValue()
+                << " is not one of its " << discrete_node->GetNumStates() << " states" << std::endl;
+      return false;
+    }
+    const ConditionalGaussianNode* conditional_node =
+        dynamic_cast<const ConditionalGaussianNode*>(node.get());
+    if (conditional_node != nullptr && !conditional_node->IsValid()) {
+      std::cerr << "Sampler node [" << node->GetName()
+                << "] has parameters that do not match its parents" << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
 int Sampler::Register(Node* node) {
   if (!node->IsEvidence()) {
     non_evidence_nodes_.push_back(node);
   }
   all_nodes_.emplace_back(node);
-  return all_nodes_.size() - 1;
+  const int registration_idx = all_nodes_.size() - 1;
+  node->Seed(sampler::DeriveSeed(sampler::DeriveSeed(seed_, kNodeStreams), registration_idx));
+  return registration_idx;
+}
+
+void Sampler::SetSeed(uint64_t seed) {
+  seed_ = seed;
+  const uint64_t node_seed = sampler::DeriveSeed(seed_, kNodeStreams);
+  for (int i = 0; i < all_nodes_.size(); ++i) {
+    all_nodes_[i]->Seed(sampler::DeriveSeed(node_seed, i));
+  }
+  SeedEngine(GetEngineSeed());
+}
+
+uint64_t Sampler::GetSeed() const {
+  return seed_;
+}
+
+uint64_t Sampler::GetEngineSeed() const {
+  return sampler::DeriveSeed(seed_, kEngineStreams);
 }
 
 Node* Sampler::GetNode(int registration_idx) {
   return all_nodes_[registration_idx].get();
 }
 
+int Sampler::GetNumNodes() const {
+  return all_nodes_.size();
+}
+
+void Sampler::SetInverseTemperature(double inverse_temperature) {
+  inverse_temperature_ = inverse_temperature;
+}
+
+double Sampler::GetInverseTemperature() const {
+  return inverse_temperature_;
+}
+
+double Sampler::TemperedLogConditional(const Node* node) const {
+  const double log_conditional = node->GetLogConditional();
+  return node->IsEvidence() ? inverse_temperature_ * log_conditional : log_conditional;
+}
+
 
 void Sampler::Register(Worker* worker) {
   worker_.reset(worker);
@@ -179,86 +720,703 @@ Worker* Sampler::GetWorker() {
   return worker_.get();
 }
 
+void Sampler::SetScheduler(sampler::Scheduler* scheduler) {
+  scheduler_ = scheduler;
+}
+
+sampler::Scheduler* Sampler::GetScheduler() {
+  if (scheduler_ == nullptr) {
+    owned_scheduler_.reset(new sampler::Scheduler);
+    scheduler_ = owned_scheduler_.get();
+  }
+  return scheduler_;
+}
+
+void Sampler::SetCancellationToken(const sampler::CancellationToken* token) {
+  cancellation_token_ = token;
+}
+
+void Sampler::SetVerbose(bool verbose) {
+  is_verbose_ = verbose;
+}
+
+bool Sampler::IsVerbose() const {
+  return is_verbose_;
+}
+
+bool Sampler::IsCancelled() const {
+  return cancellation_token_ != nullptr && cancellation_token_->IsCancelled();
+}
+
+bool Sampler::EndSweep() {
+  GetWorker()->Sample(this);
+  return CompleteSweeps(1);
+}
+
+bool Sampler::CompleteSweeps(int num_sweeps) {
+  const int64_t previous_checkpoint = checkpointer_ ? num_sweeps_ / checkpoint_interval_ : 0;
+  num_sweeps_ += num_sweeps;
+  if (checkpointer_ && num_sweeps_ / checkpoint_interval_ != previous_checkpoint) {
+    // Only the copy happens on the sampling thread; the Checkpointer's own
+    // thread does the file write.
+    checkpointer_->WriteAsync(Snapshot());
+  }
+  if (publisher_ && num_sweeps_ / publish_interval_ != (num_sweeps_ - num_sweeps) / publish_interval_) {
+    Publish();
+  }
+  return !IsCancelled();
+}
+
+void Sampler::Publish() {
+  if (!worker_ || !worker_->GetSummary(&summary_)) {
+    return;
+  }
+  summary_.num_sweeps = num_sweeps_;
+  summary_.acceptance_rate = GetAcceptanceRate();
+  publisher_->Publish(summary_);
+}
+
+void Sampler::EnablePublishing(const std::string& shm_name, int max_bins, int interval) {
+  publisher_.reset();
+  publish_interval_ = interval;
+  if (interval > 0) {
+    publisher_.reset(new sampler::SharedPosteriorPublisher(shm_name, max_bins));
+  }
+}
+
+double Sampler::GetAcceptanceRate() const {
+  return 1.0;
+}
+
+int64_t Sampler::GetNumSweeps() const {
+  return num_sweeps_;
+}
+
+std::string Sampler::Snapshot() const {
+  std::string snapshot;
+  sampler::StateWriter writer(&snapshot);
+  writer.WriteString(kSnapshotMagic);
+  writer.WriteInt64(seed_);
+  writer.WriteInt64(num_sweeps_);
+  writer.WriteInt64(all_nodes_.size());
+  for (const auto& node : all_nodes_) {
+    node->SaveState(&writer);
+  }
+  if (worker_) {
+    worker_->SaveState(&writer);
+  }
+  SaveEngineState(&writer);
+  return snapshot;
+}
+
+bool Sampler::Restore(const std::string& snapshot) {
+  sampler::StateReader reader(snapshot);
+  std::string magic;
+  int64_t seed = 0;
+  int64_t num_nodes = 0;
+  if (!reader.ReadString(&magic) || magic != kSnapshotMagic ||
+      !reader.ReadInt64(&seed) ||
+      !reader.ReadInt64(&num_sweeps_) ||
+      !reader.ReadInt64(&num_nodes) || num_nodes != all_nodes_.size()) {
+    std::cerr << "Sampler::Restore snapshot header does not match this model" << std::endl;
+    return false;
+  }
+  seed_ = seed;
+  for (const auto& node : all_nodes_) {
+    if (!node->LoadState(&reader)) {
+      std::cerr << "Sampler::Restore failed on node [" << node->GetName() << "]" << std::endl;
+      return false;
+    }
+  }
+  if ((worker_ && !worker_->LoadState(&reader)) || !LoadEngineState(&reader) || !reader.AtEnd()) {
+    std::cerr << "Sampler::Restore worker or engine state does not match this model" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool Sampler::RestoreFromFile(const std::string& path) {
+  std::string snapshot;
+  if (!sampler::ReadCheckpointFile(path, &snapshot)) {
+    std::cerr << "Sampler::RestoreFromFile cannot read " << path << std::endl;
+    return false;
+  }
+  return Restore(snapshot);
+}
+
+void Sampler::EnableCheckpoints(const std::string& path, int interval) {
+  FlushCheckpoints();
+  checkpointer_.reset();
+  checkpoint_interval_ = interval;
+  if (interval > 0) {
+    checkpointer_.reset(new sampler::Checkpointer(path));
+  }
+}
+
+void Sampler::FlushCheckpoints() {
+  if (checkpointer_) {
+    checkpointer_->Flush();
+  }
+}
+
 GaussianSource::GaussianSource(double sigma2) :
   normal_distribution_(0.0, sigma2),
   generator_()
 {}
 
+void GaussianSource::Seed(uint64_t seed) {
+  generator_.seed(seed);
+  normal_distribution_.reset();
+}
+
 double GaussianSource::Draw() {
   return normal_distribution_(generator_);
 }
 
+void GaussianSource::SaveState(sampler::StateWriter* writer) const {
+  // The distribution caches the second of each pair of normal variates.
+  sampler::WriteRandomState(normal_distribution_, writer);
+  sampler::WriteRandomState(generator_, writer);
+}
+
+bool GaussianSource::LoadState(sampler::StateReader* reader) {
+  return sampler::ReadRandomState(reader, &normal_distribution_) &&
+         sampler::ReadRandomState(reader, &generator_);
+}
+
+UniformSource::UniformSource() :
+  uniform_distribution_(0.0, 1.0),
+  generator_()
+{}
+
+void UniformSource::Seed(uint64_t seed) {
+  generator_.seed(seed);
+  uniform_distribution_.reset();
+}
+
+double UniformSource::Draw() {
+  return uniform_distribution_(generator_);
+}
+
+void UniformSource::SaveState(sampler::StateWriter* writer) const {
+  sampler::WriteRandomState(generator_, writer);
+}
+
+bool UniformSource::LoadState(sampler::StateReader* reader) {
+  return sampler::ReadRandomState(reader, &generator_);
+}
+
 GaussianProposalDensity1D::GaussianProposalDensity1D(double sigma2) :
   norm_(sqrt(0.5 / sigma2 / M_PI)),
   half_inv_sigma2_(0.5 / sigma2),
   gaussian_source_(sigma2)
 {}
 
+void GaussianProposalDensity1D::Seed(uint64_t seed) {
+  gaussian_source_.Seed(seed);
+}
+
+void GaussianProposalDensity1D::SaveState(sampler::StateWriter* writer) const {
+  gaussian_source_.SaveState(writer);
+}
+
+bool GaussianProposalDensity1D::LoadState(sampler::StateReader* reader) {
+  return gaussian_source_.LoadState(reader);
+}
+
 double GaussianProposalDensity1D::Draw(double current_value) {
   //return current_value * (1.0  + gaussian_source_.Draw());
   return current_value + gaussian_source_.Draw();
 }
 
+GaussianProposalDensityND::GaussianProposalDensityND(int dim, double sigma2) :
+  dim_(dim),
+  cholesky_(dim * dim, 0.0),
+  sample_mean_(dim, 0.0),
+  sample_comoment_(dim * dim, 0.0),
+  num_samples_(0),
+  draw_buffer_(dim, 0.0),
+  standard_normal_(1.0)
+{
+  for (int i = 0; i < dim_; ++i) {
+    cholesky_[i * dim_ + i] = sqrt(sigma2);
+  }
+}
+
+int GaussianProposalDensityND::GetDimension() const {
+  return dim_;
+}
+
+void GaussianProposalDensityND::Draw(const std::vector<double>& current_values,
+                                     std::vector<double>* proposal) {
+  for (int i = 0; i < dim_; ++i) {
+    draw_buffer_[i] = standard_normal_.Draw();
+  }
+  proposal->resize(dim_);
+  for (int i = 0; i < dim_; ++i) {
+    double offset = 0.0;
+    for (int j = 0; j <= i; ++j) {
+      offset += cholesky_[i * dim_ + j] * draw_buffer_[j];
+    }
+    (*proposal)[i] = current_values[i] + offset;
+  }
+}
+
+double GaussianProposalDensityND::GetLogTransitionProbability(
+    const std::vector<double>& from, const std::vector<double>& to) const {
+  // Solving L * y = to - from gives a log density of -|y|^2 / 2.
+  std::vector<double> y(dim_);
+  for (int i = 0; i < dim_; ++i) {
+    y[i] = to[i] - from[i];
+  }
+  sampler::SolveLower(dim_, cholesky_, &y);
+  double squared_norm = 0.0;
+  for (int i = 0; i < dim_; ++i) {
+    squared_norm += y[i] * y[i];
+  }
+  return -0.5 * squared_norm;
+}
+
+void GaussianProposalDensityND::Accumulate(const std::vector<double>& sample) {
+  ++num_samples_;
+  for (int i = 0; i < dim_; ++i) {
+    draw_buffer_[i] = sample[i] - sample_mean_[i];
+    sample_mean_[i] += draw_buffer_[i] / num_samples_;
+  }
+  for (int i = 0; i < dim_; ++i) {
+    for (int j = 0; j < dim_; ++j) {
+      sample_comoment_[i * dim_ + j] += draw_buffer_[i] * (sample[j] - sample_mean_[j]);
+    }
+  }
+}
+
+void GaussianProposalDensityND::Adapt() {
+  if (num_samples_ <= dim_) {
+    return;
+  }
+  // Small ridge keeps the factorization defined for nearly degenerate chains.
+  const double ridge = 1e-6;
+  const double scale = 2.38 * 2.38 / dim_ / (num_samples_ - 1);
+  std::vector<double> covariance(sample_comoment_);
+  for (int i = 0; i < dim_ * dim_; ++i) {
+    covariance[i] *= scale;
+  }
+  for (int i = 0; i < dim_; ++i) {
+    covariance[i * dim_ + i] += ridge;
+  }
+  if (sampler::CholeskyDecompose(dim_, &covariance)) {
+    cholesky_.swap(covariance);
+  } else {
+    std::cerr << "GaussianProposalDensityND::Adapt covariance not positive definite, keeping previous" << std::endl;
+  }
+}
+
+void GaussianProposalDensityND::Seed(uint64_t seed) {
+  standard_normal_.Seed(seed);
+}
+
+void GaussianProposalDensityND::SaveState(sampler::StateWriter* writer) const {
+  writer->WriteDoubles(cholesky_);
+  writer->WriteDoubles(sample_mean_);
+  writer->WriteDoubles(sample_comoment_);
+  writer->WriteInt64(num_samples_);
+  standard_normal_.SaveState(writer);
+}
+
+bool GaussianProposalDensityND::LoadState(sampler::StateReader* reader) {
+  int64_t num_samples = 0;
+  if (!reader->ReadDoubles(&cholesky_) || cholesky_.size() != dim_ * dim_ ||
+      !reader->ReadDoubles(&sample_mean_) || sample_mean_.size() != dim_ ||
+      !reader->ReadDoubles(&sample_comoment_) || sample_comoment_.size() != dim_ * dim_ ||
+      !reader->ReadInt64(&num_samples)) {
+    return false;
+  }
+  num_samples_ = num_samples;
+  return standard_normal_.LoadState(reader);
+}
+
 MetroSampler::MetroSampler(ProposalDensity1D* proposal) :
-    proposal_density_(proposal)
-{}
+    proposal_density_(proposal),
+    num_adaptation_iterations_(0),
+    num_adapted_iterations_(0),
+    num_proposals_(0),
+    num_accepted_proposals_(0)
+{
+  SeedEngine(GetEngineSeed());
+}
+
+MetroSampler::~MetroSampler() {}
+
+bool MetroSampler::GetUnblockedNodes(const std::vector<int>& node_idxs,
+                                     std::vector<Node*>* nodes) {
+  std::set<Node*> blocked;
+  for (const auto& block : blocks_) {
+    blocked.insert(block->nodes.begin(), block->nodes.end());
+  }
+  for (const auto& block : exact_blocks_) {
+    blocked.insert(block->GetNodes().begin(), block->GetNodes().end());
+  }
+  nodes->clear();
+  if (node_idxs.empty()) {
+    std::cerr << "MetroSampler block has no nodes" << std::endl;
+    return false;
+  }
+  for (int node_idx : node_idxs) {
+    if (node_idx < 0 || node_idx >= GetNumNodes()) {
+      std::cerr << "MetroSampler block has no node " << node_idx << std::endl;
+      return false;
+    }
+    Node* node = GetNode(node_idx);
+    if (node->IsEvidence()) {
+      std::cerr << "MetroSampler block node [" << node->GetName() << "] is evidence" << std::endl;
+      return false;
+    }
+    if (dynamic_cast<DiscreteNode*>(node) != nullptr) {
+      std::cerr << "MetroSampler block node [" << node->GetName() << "] is discrete" << std::endl;
+      return false;
+    }
+    if (!blocked.insert(node).second) {
+      std::cerr << "MetroSampler block node [" << node->GetName()
+                << "] is repeated or already in a block" << std::endl;
+      return false;
+    }
+    nodes->push_back(node);
+  }
+  return true;
+}
+
+bool MetroSampler::AddBlock(const std::vector<int>& node_idxs,
+                            ProposalDensityND* proposal) {
+  std::unique_ptr<ProposalDensityND> proposal_density(proposal);
+  std::vector<Node*> nodes;
+  if (!GetUnblockedNodes(node_idxs, &nodes)) {
+    return false;
+  }
+  return AddBlockNodes(nodes, proposal_density.release());
+}
+
+bool MetroSampler::AddBlockNodes(const std::vector<Node*>& nodes,
+                                 ProposalDensityND* proposal) {
+  std::unique_ptr<ProposalDensityND> proposal_density(proposal);
+  if (proposal_density->GetDimension() != nodes.size()) {
+    std::cerr << "MetroSampler::AddBlock proposal dimension " << proposal_density->GetDimension()
+              << " does not match block size " << nodes.size() << ", ignoring block" << std::endl;
+    return false;
+  }
+
+  std::unique_ptr<Block> block(new Block);
+  block->nodes = nodes;
+  std::set<Node*> in_blanket(nodes.begin(), nodes.end());
+  block->markov_blanket = nodes;
+  for (Node* node : nodes) {
+    for (Node* child : node->GetChildren()) {
+      if (in_blanket.insert(child).second) {
+        block->markov_blanket.push_back(child);
+      }
+    }
+  }
+  block->proposal_density.swap(proposal_density);
+  block->proposal_density->Seed(sampler::DeriveSeed(
+      sampler::DeriveSeed(GetEngineSeed(), kBlockStreams), blocks_.size()));
+  block->original.resize(nodes.size());
+  block->proposal.resize(nodes.size());
+  blocks_.emplace_back(block.release());
+  return true;
+}
+
+void MetroSampler::AddAutomaticBlocks(int max_block_size, double sigma2) {
+  std::set<Node*> blocked;
+  for (const auto& block : blocks_) {
+    blocked.insert(block->nodes.begin(), block->nodes.end());
+  }
+  for (const auto& block : exact_blocks_) {
+    blocked.insert(block->GetNodes().begin(), block->GetNodes().end());
+  }
+
+  for (Node* seed : NonEvidenceNodes()) {
+    if (blocked.count(seed) || dynamic_cast<DiscreteNode*>(seed) != nullptr) {
+      continue;
+    }
+    // Breadth-first over non-evidence neighbours, so each block is a
+    // connected piece of the graph.
+    std::vector<Node*> nodes(1, seed);
+    blocked.insert(seed);
+    for (int i = 0; i < nodes.size() && nodes.size() < max_block_size; ++i) {
+      std::vector<Node*> neighbours(nodes[i]->GetParents());
+      neighbours.insert(neighbours.end(), nodes[i]->GetChildren().begin(), nodes[i]->GetChildren().end());
+      for (Node* neighbour : neighbours) {
+        if (nodes.size() >= max_block_size) {
+          break;
+        }
+        if (!neighbour->IsEvidence() && dynamic_cast<DiscreteNode*>(neighbour) == nullptr &&
+            blocked.insert(neighbour).second) {
+          nodes.push_back(neighbour);
+        }
+      }
+    }
+    if (nodes.size() > 1) {
+      AddBlockNodes(nodes, new GaussianProposalDensityND(nodes.size(), sigma2));
+    } else {
+      blocked.erase(seed);
+    }
+  }
+}
+
+bool MetroSampler::AddExactGaussianBlock(const std::vector<int>& node_idxs) {
+  std::vector<Node*> nodes;
+  if (!GetUnblockedNodes(node_idxs, &nodes) ||
+      !sampler::GaussianSubnetwork::IsLinearGaussian(nodes)) {
+    return false;
+  }
+  std::unique_ptr<sampler::GaussianSubnetwork> subnetwork(
+      new sampler::GaussianSubnetwork(nodes, GetInverseTemperature()));
+  if (!subnetwork->IsValid()) {
+    return false;
+  }
+  subnetwork->Seed(sampler::DeriveSeed(
+      sampler::DeriveSeed(GetEngineSeed(), kExactBlockStreams), exact_blocks_.size()));
+  exact_blocks_.emplace_back(subnetwork.release());
+  return true;
+}
+
+void MetroSampler::SetAdaptationIterations(int num_iterations) {
+  num_adaptation_iterations_ = num_iterations;
+}
+
+void MetroSampler::SeedEngine(uint64_t engine_seed) {
+  uniform_source_.Seed(sampler::DeriveSeed(engine_seed, kAcceptanceStream));
+  proposal_density_->Seed(sampler::DeriveSeed(engine_seed, kScalarProposalStream));
+  const uint64_t block_seed = sampler::DeriveSeed(engine_seed, kBlockStreams);
+  for (int k = 0; k < blocks_.size(); ++k) {
+    blocks_[k]->proposal_density->Seed(sampler::DeriveSeed(block_seed, k));
+  }
+  const uint64_t exact_block_seed = sampler::DeriveSeed(engine_seed, kExactBlockStreams);
+  for (int k = 0; k < exact_blocks_.size(); ++k) {
+    exact_blocks_[k]->Seed(sampler::DeriveSeed(exact_block_seed, k));
+  }
+}
+
+void MetroSampler::SaveEngineState(sampler::StateWriter* writer) const {
+  uniform_source_.SaveState(writer);
+  proposal_density_->SaveState(writer);
+  writer->WriteInt64(num_adapted_iterations_);
+  writer->WriteInt64(num_proposals_);
+  writer->WriteInt64(num_accepted_proposals_);
+  writer->WriteInt64(blocks_.size());
+  for (const auto& block : blocks_) {
+    block->proposal_density->SaveState(writer);
+  }
+  writer->WriteInt64(exact_blocks_.size());
+  for (const auto& block : exact_blocks_) {
+    block->SaveState(writer);
+  }
+}
+
+bool MetroSampler::LoadEngineState(sampler::StateReader* reader) {
+  int64_t num_adapted_iterations = 0;
+  int64_t num_blocks = 0;
+  if (!uniform_source_.LoadState(reader) ||
+      !proposal_density_->LoadState(reader) ||
+      !reader->ReadInt64(&num_adapted_iterations) ||
+      !reader->ReadInt64(&num_proposals_) ||
+      !reader->ReadInt64(&num_accepted_proposals_) ||
+      !reader->ReadInt64(&num_blocks) || num_blocks != blocks_.size()) {
+    return false;
+  }
+  num_adapted_iterations_ = num_adapted_iterations;
+  for (const auto& block : blocks_) {
+    if (!block->proposal_density->LoadState(reader)) {
+      return false;
+    }
+  }
+  int64_t num_exact_blocks = 0;
+  if (!reader->ReadInt64(&num_exact_blocks) || num_exact_blocks != exact_blocks_.size()) {
+    return false;
+  }
+  for (const auto& block : exact_blocks_) {
+    if (!block->LoadState(reader)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void MetroSampler::Reset() {
+  num_proposals_ = 0;
+  num_accepted_proposals_ = 0;
+  Sampler::Reset();
+}
+
+double MetroSampler::GetAcceptanceRate() const {
+  return num_proposals_ > 0 ? double(num_accepted_proposals_) / num_proposals_ : 1.0;
+}
+
+void MetroSampler::SetInverseTemperature(double inverse_temperature) {
+  Sampler::SetInverseTemperature(inverse_temperature);
+  for (const auto& block : exact_blocks_) {
+    block->SetEvidenceInverseTemperature(inverse_temperature);
+  }
+}
+
+bool MetroSampler::Prepare() {
+  if (!HasValidDiscreteNodes()) {
+    scalar_nodes_.clear();
+    discrete_nodes_.clear();
+    return false;
+  }
+  std::set<Node*> blocked;
+  for (const auto& block : blocks_) {
+    blocked.insert(block->nodes.begin(), block->nodes.end());
+  }
+  for (const auto& block : exact_blocks_) {
+    blocked.insert(block->GetNodes().begin(), block->GetNodes().end());
+  }
+  scalar_nodes_.clear();
+  discrete_nodes_.clear();
+  for (Node* node : NonEvidenceNodes()) {
+    if (blocked.count(node)) {
+      continue;
+    }
+    DiscreteNode* discrete_node = dynamic_cast<DiscreteNode*>(node);
+    if (discrete_node != nullptr) {
+      discrete_nodes_.push_back(discrete_node);
+    } else {
+      scalar_nodes_.push_back(node);
+    }
+  }
+  return true;
+}
 
 void MetroSampler::Infer(int num_iterations) {
-  std::cerr << "MetroSampler::Infer going for " << num_iterations << " iterations" << std::endl;
+  if (IsVerbose()) {
+    std::cerr << "MetroSampler::Infer going for " << num_iterations << " iterations" << std::endl;
+  }
+  if (!Prepare()) {
+    std::cerr << "MetroSampler::Infer model is invalid" << std::endl;
+    return;
+  }
   for (int i = 0; i < num_iterations; ++i) {
-    for (Node* node : NonEvidenceNodes()) {
-      MetroStep(node);
+    Sweep();
+    if (!EndSweep()) {
+      if (IsVerbose()) {
+        std::cerr << "MetroSampler::Infer cancelled after " << i + 1 << " iterations" << std::endl;
+      }
+      break;
+    }
+  }
+  if (IsVerbose()) {
+    std::cerr << "MetroSampler::Infer done" << std::endl;
+  }
+}
+
+void MetroSampler::Sweep() {
+  for (Node* node : scalar_nodes_) {
+    MetroStep(node);
+  }
+  for (DiscreteNode* node : discrete_nodes_) {
+    node->GibbsStep(GetInverseTemperature());
+  }
+  for (const auto& block : blocks_) {
+    BlockStep(block.get());
+  }
+  for (const auto& block : exact_blocks_) {
+    block->Sample();
+  }
+  if (num_adapted_iterations_ < num_adaptation_iterations_) {
+    ++num_adapted_iterations_;
+    for (const auto& block : blocks_) {
+      block->proposal_density->Accumulate(block->original);
+      if (num_adapted_iterations_ % kAdaptationInterval == 0) {
+        block->proposal_density->Adapt();
+      }
     }
-    GetWorker()->Sample(this);
   }
-  std::cerr << "MetroSampler::Infer done" << std::endl;
 }
 
 void MetroSampler::MetroStep(Node* node) {
   double original = node->GetValue();
   double proposal = proposal_density_->Draw(original);  
-  double likelihood_ratio = GetLikelihoodRatio(node, proposal, original);
-  double transition_odds = GetTransitionProbabilityRatio(node, proposal, original);
-  double transition_probability = likelihood_ratio * transition_odds; 
+  // In log space, like BlockStep(): far from the mode the conditionals
+  // underflow and their ratio would be 0 / 0.
+  double log_likelihood_ratio = GetLogLikelihoodRatio(node, proposal, original);
+  double log_transition_odds = GetLogTransitionProbabilityRatio(proposal, original);
+  double log_ratio = log_likelihood_ratio + log_transition_odds;
   /*
   std::cerr << "MetroSampler::MetroStep node [" << node->GetName()
             << "] original: " << original
             << " proposal: " << proposal
-            << " r_likelihood: " << likelihood_ratio
+            << " log_r_likelihood: " << log_likelihood_ratio
             << std::endl;
             */
-  if (transition_probability >= 1.0 ||
-      NormUniformDraw() < transition_probability) {
+  ++num_proposals_;
+  if (log_ratio >= 0.0 ||
+      log(uniform_source_.Draw()) < log_ratio) {
     node->SetValue(proposal);
+    ++num_accepted_proposals_;
   } else {
     node->SetValue(original);
   }
 }
 
-double MetroSampler::GetLikelihoodRatio(Node* node,
-                                        double proposal,
-                                        double original) {
-  return GetUnnormalizedLikelihood(node, proposal) /
-          GetUnnormalizedLikelihood(node, original);
+void MetroSampler::BlockStep(Block* block) {
+  for (int i = 0; i < block->nodes.size(); ++i) {
+    block->original[i] = block->nodes[i]->GetValue();
+  }
+  block->proposal_density->Draw(block->original, &block->proposal);
+
+  // Only conditionals that mention a block node change, so the acceptance
+  // ratio is evaluated over the union of the block nodes' Markov blankets.
+  double log_ratio =
+      GetBlockLogLikelihood(block, block->proposal) -
+      GetBlockLogLikelihood(block, block->original) +
+      block->proposal_density->GetLogTransitionProbability(block->proposal, block->original) -
+      block->proposal_density->GetLogTransitionProbability(block->original, block->proposal);
+
+  ++num_proposals_;
+  if (log_ratio >= 0.0 || log(uniform_source_.Draw()) < log_ratio) {
+    block->original.swap(block->proposal);
+    ++num_accepted_proposals_;
+  }
+  // block->original now holds the accepted state.
+  for (int i = 0; i < block->nodes.size(); ++i) {
+    block->nodes[i]->SetValue(block->original[i]);
+  }
+}
+
+double MetroSampler::GetBlockLogLikelihood(Block* block,
+                                           const std::vector<double>& values) {
+  for (int i = 0; i < block->nodes.size(); ++i) {
+    block->nodes[i]->SetValue(values[i]);
+  }
+  double log_likelihood = 0.0;
+  for (Node* node : block->markov_blanket) {
+    log_likelihood += TemperedLogConditional(node);
+  }
+  return log_likelihood;
+}
+
+double MetroSampler::GetLogLikelihoodRatio(Node* node,
+                                           double proposal,
+                                           double original) {
+  return GetUnnormalizedLogLikelihood(node, proposal) -
+          GetUnnormalizedLogLikelihood(node, original);
 }
 
-double MetroSampler::GetTransitionProbabilityRatio(
-    Node* node, double proposal, double original) {
-  return proposal_density_->GetUnnormalizedTransitionProbability(proposal, original) /
-    proposal_density_->GetUnnormalizedTransitionProbability(original, proposal);
+double MetroSampler::GetLogTransitionProbabilityRatio(double proposal, double original) {
+  return proposal_density_->GetLogTransitionProbability(proposal, original) -
+    proposal_density_->GetLogTransitionProbability(original, proposal);
 }
 
-double MetroSampler::GetUnnormalizedLikelihood(
+double MetroSampler::GetUnnormalizedLogLikelihood(
     Node* node, double value) {
   double original = node->GetValue();
   node->SetValue(value);
-  double likelihood = node->GetConditional();
+  double log_likelihood = TemperedLogConditional(node);
   for (Node* child : node->GetChildren()) {
-    // FIXME - change to log domain.
-    likelihood *= child->GetConditional(); 
+    log_likelihood += TemperedLogConditional(child);
   }
   node->SetValue(original);
-  return likelihood;
+  return log_likelihood;
 }
 
 double GaussianProposalDensity1D::GetUnnormalizedTransitionProbability(
@@ -266,10 +1424,24 @@ double GaussianProposalDensity1D::GetUnnormalizedTransitionProbability(
   return Gaussian(from - to, half_inv_sigma2_); 
 }
 
+double ProposalDensity1D::GetLogTransitionProbability(double from, double to) const {
+  return log(GetUnnormalizedTransitionProbability(from, to));
+}
+
+double GaussianProposalDensity1D::GetLogTransitionProbability(double from, double to) const {
+  const double step = from - to;
+  return -step * step * half_inv_sigma2_;
+}
+
 void Sampler::Reset() {
+  // Ancestral draws read the tables, so an invalid model keeps its values;
+  // the engines then refuse to run it.
+  const bool can_draw = HasValidDiscreteNodes();
   std::unique_ptr<std::vector<Node*>> q1(new std::vector<Node*>);
   std::unique_ptr<std::vector<Node*>> q2(new std::vector<Node*>);
   for (int i = 0; i < all_nodes_.size(); ++i) {
+    // Re-running Reset() on a reused Sampler must still draw ancestrally.
+    all_nodes_[i]->ClearInitialized();
     q1->push_back(all_nodes_[i].get());
   }
 
@@ -279,7 +1451,9 @@ void Sampler::Reset() {
         node->SetInitialized();
       } else {
         if (node->AllParentsInitialized()) {
-          node->SetValue(node->GetSample());
+          if (can_draw) {
+            node->SetValue(node->GetSample());
+          }
           node->SetInitialized();
         } else {
           q2->push_back(node);
@@ -290,12 +1464,51 @@ void Sampler::Reset() {
     q1.swap(q2);
   }
 
-  worker_->Reset();
+  if (worker_) {
+    worker_->Reset();
+  }
+}
+
+void GibbsSampler::Infer(int num_iterations) {
+  if (IsVerbose()) {
+    std::cerr << "GibbsSampler::Infer going for " << num_iterations << " iterations" << std::endl;
+  }
+  discrete_nodes_.clear();
+  if (!HasValidDiscreteNodes()) {
+    std::cerr << "GibbsSampler::Infer model is invalid" << std::endl;
+    return;
+  }
+  for (Node* node : NonEvidenceNodes()) {
+    DiscreteNode* discrete_node = dynamic_cast<DiscreteNode*>(node);
+    if (discrete_node == nullptr) {
+      std::cerr << "GibbsSampler::Infer node [" << node->GetName()
+                << "] is not discrete and will not be updated" << std::endl;
+      continue;
+    }
+    discrete_nodes_.push_back(discrete_node);
+  }
+  for (int i = 0; i < num_iterations; ++i) {
+    for (DiscreteNode* node : discrete_nodes_) {
+      node->GibbsStep();
+    }
+    if (!EndSweep()) {
+      if (IsVerbose()) {
+        std::cerr << "GibbsSampler::Infer cancelled after " << i + 1 << " iterations" << std::endl;
+      }
+      break;
+    }
+  }
+  if (IsVerbose()) {
+    std::cerr << "GibbsSampler::Infer done" << std::endl;
+  }
 }
 
 HistogramWorker::HistogramWorker(double range_start, double range_end, int num_bins, int node_idx) :
   histogram_(range_start, range_end, num_bins),
-  node_idx_(node_idx)
+  node_idx_(node_idx),
+  num_samples_(0),
+  mean_(0.0),
+  sum_squared_deviations_(0.0)
 {}
 
 std::string HistogramWorker::ToJsonString() const {
@@ -304,13 +1517,44 @@ std::string HistogramWorker::ToJsonString() const {
 
 void HistogramWorker::Reset() {
   histogram_.Reset();
-  std::cerr << "HistogramWorker::Reset:" << std::endl;
-  std::cerr << histogram_.ToJsonString() << std::endl;
+  num_samples_ = 0;
+  mean_ = 0.0;
+  sum_squared_deviations_ = 0.0;
+}
+
+void HistogramWorker::SaveState(sampler::StateWriter* writer) const {
+  writer->WriteInts(histogram_.GetCounts());
+  writer->WriteInt64(num_samples_);
+  writer->WriteDouble(mean_);
+  writer->WriteDouble(sum_squared_deviations_);
+}
+
+bool HistogramWorker::LoadState(sampler::StateReader* reader) {
+  std::vector<int> counts;
+  return reader->ReadInts(&counts) && histogram_.SetCounts(counts) &&
+         reader->ReadInt64(&num_samples_) && reader->ReadDouble(&mean_) &&
+         reader->ReadDouble(&sum_squared_deviations_);
+}
+
+bool HistogramWorker::GetSummary(sampler::PosteriorSummary* summary) const {
+  const std::vector<int>& counts = histogram_.GetCounts();
+  summary->range_start = histogram_.GetRangeStart();
+  summary->range_end = histogram_.GetRangeEnd();
+  summary->num_bins = counts.size() - 2;
+  summary->counts.assign(counts.begin(), counts.end());
+  summary->num_samples = num_samples_;
+  summary->mean = mean_;
+  summary->variance = num_samples_ > 1 ? sum_squared_deviations_ / (num_samples_ - 1) : 0.0;
+  return true;
 }
 
 void HistogramWorker::Sample(Sampler* sampler) {
   double sample = sampler->GetNode(node_idx_)->GetValue();
   //std::cerr << "HistogramWorker sample " << sample << std::endl; 
   histogram_.Accumulate(sample);
+  ++num_samples_;
+  const double deviation = sample - mean_;
+  mean_ += deviation / num_samples_;
+  sum_squared_deviations_ += deviation * (sample - mean_);
 }
 
@@ -1,10 +1,25 @@
 #ifndef FRAMEWORK_H
 #define FRAMEWORK_H
 
-#include <vector>
+#include <cstdint>
+#include <memory>
 #include <random>
+#include <string>
+#include <vector>
 
+#include "aligned.h"
+#include "checkpoint.h"
 #include "histogram.h"
+#include "scheduler.h"
+#include "shared_posterior.h"
+
+namespace sampler {
+class GaussianSubnetwork;
+
+// Seed for random stream number stream of a generator family seeded with
+// seed. Distinct streams get well-mixed, unrelated seeds.
+uint64_t DeriveSeed(uint64_t seed, uint64_t stream);
+}  // namespace sampler
 
 class GaussianSource {
   private:
@@ -13,7 +28,25 @@ class GaussianSource {
 
   public:
   GaussianSource(double sigma2);
+  void Seed(uint64_t seed);
+  double Draw();
+  void SaveState(sampler::StateWriter* writer) const;
+  bool LoadState(sampler::StateReader* reader);
+};
+
+// Uniform draws on [0, 1). Each owner keeps its own generator so that every
+// random stream can be checkpointed and threads never share one.
+class UniformSource {
+  private:
+  std::uniform_real_distribution<double> uniform_distribution_;
+  std::default_random_engine generator_;
+
+  public:
+  UniformSource();
+  void Seed(uint64_t seed);
   double Draw();
+  void SaveState(sampler::StateWriter* writer) const;
+  bool LoadState(sampler::StateReader* reader);
 };
 
 class Node {
@@ -28,8 +61,24 @@ class Node {
   void AddChild(Node* node);
 
   public:
+  virtual ~Node() {}
   virtual double GetConditional() const = 0;
+  // log(GetConditional()); overridden where a closed form avoids underflow.
+  virtual double GetLogConditional() const;
   virtual double GetSample() = 0;
+  // Reseeds the node's random streams, if it has any. Sampler::Register()
+  // and Sampler::SetSeed() give every node its own seed.
+  virtual void Seed(uint64_t seed) {}
+  // Checkpointing; subclasses with extra mutable state extend these.
+  virtual void SaveState(sampler::StateWriter* writer) const;
+  virtual bool LoadState(sampler::StateReader* reader);
+  // Adds to log_densities[s] this node's log conditional with the discrete
+  // parent set to state s, for every s < num_states. The default sets the
+  // parent to each state in turn; table-driven nodes override it to read
+  // all states in one pass.
+  virtual void AddLogConditionalsOverParentStates(Node* parent,
+                                                  int num_states,
+                                                  double* log_densities) const;
 
   double GetValue() const;
   void SetValue(double value);
@@ -53,9 +102,70 @@ class Node {
   Node(const std::string& debug_name = "hieronymous");
 };
 
+// Categorical node with states 0 .. num_states - 1, stored as its value.
+// Every parent must be a DiscreteNode. The conditional probability table
+// is flat: row c holds the num_states probabilities for parent
+// configuration c, and configurations count in mixed radix with the
+// last-added parent varying fastest.
 class DiscreteNode : public Node {
+  private:
+  int num_states_;
+  // Rows are padded to a multiple of a cache line so every row starts on
+  // one; padding entries are never read.
+  int row_stride_;
+  sampler::AlignedVector<double> cpt_;
+  sampler::AlignedVector<double> log_cpt_;
+  // Scratch rows of per-state blanket log densities for GibbsStep().
+  sampler::AlignedVector<double> log_densities_;
+  sampler::AlignedVector<double> evidence_log_densities_;
+  // Cached stride of each parent in the configuration index, and whether
+  // the parents match the table; rebuilt if parents are added after first
+  // use.
+  mutable std::vector<int> parent_strides_;
+  mutable int num_cached_parents_;
+  mutable bool is_valid_;
+  bool has_whole_rows_;
+  UniformSource uniform_source_;
+
+  const std::vector<int>& GetParentStrides() const;
+
   public:
+  DiscreteNode(int num_states, const std::vector<double>& cpt, const std::string& debug_name = "anon_discrete");
   double GetConditional() const override;
+  double GetLogConditional() const override;
+  double GetSample() override;
+  void Seed(uint64_t seed) override;
+  void SaveState(sampler::StateWriter* writer) const override;
+  bool LoadState(sampler::StateReader* reader) override;
+  void AddLogConditionalsOverParentStates(Node* parent,
+                                          int num_states,
+                                          double* log_densities) const override;
+
+  // False if the table is not a whole number of rows, a parent is not a
+  // DiscreteNode, or the table has not one row per parent configuration.
+  // An invalid node never reads its table: its conditional is 0 and it
+  // keeps its value. Engines refuse to run models containing one.
+  bool IsValid() const;
+  // Whether the value is one of the states 0 .. num_states - 1. The table
+  // lookups assume it is, for this node and its parents; engines check it
+  // with every other registered node before sampling, since evidence can
+  // be set to anything.
+  bool HasValidState() const;
+  int GetNumStates() const;
+  int GetState() const;
+  // Index of the current parent configuration into the table rows.
+  int GetParentConfiguration() const;
+  // Gibbs update: enumerates every state, evaluates the Markov blanket log
+  // density of each, and draws the new state from their normalization.
+  // Evidence children's log densities are scaled by
+  // evidence_inverse_temperature (see Sampler::SetInverseTemperature).
+  void GibbsStep(double evidence_inverse_temperature = 1.0);
+};
+
+class DiscreteEvidenceNode : public DiscreteNode {
+  public:
+  DiscreteEvidenceNode(int num_states, const std::vector<double>& cpt, int state, const std::string& debug_name = "anon_discrete_evidence");
+  double GetSample() override;
 };
 
 class ContinuousNode : public Node {
@@ -76,8 +186,60 @@ class GaussianNode : public ContinuousNode {
   public:
   GaussianNode(const std::vector<double>& beta, double sigma2, const std::string& debug_name = "anon_gaussian");
   double GetConditional() const override;
+  double GetLogConditional() const override;
   virtual double GetSample() override;
+  void Seed(uint64_t seed) override;
+  void SaveState(sampler::StateWriter* writer) const override;
+  bool LoadState(sampler::StateReader* reader) override;
   double GetMean() const;
+  // beta[0] is the intercept, beta[i + 1] the coefficient of parent i.
+  const std::vector<double>& GetBeta() const;
+  double GetSigma2() const;
+};
+
+// Gaussian whose parameters are selected by its DiscreteNode parents:
+// betas[c] and sigma2s[c] apply under discrete parent configuration c
+// (ordered as in DiscreteNode). The mean is linear in the remaining,
+// continuous parents: betas[c][0] + sum_i betas[c][i + 1] * x_i in the
+// order those parents were added.
+class ConditionalGaussianNode : public ContinuousNode {
+  private:
+  std::vector<std::vector<double>> betas_;
+  std::vector<double> half_inv_sigma2s_;
+  std::vector<double> sigmas_;
+  GaussianSource standard_normal_;
+  // Cached split of the parents; rebuilt if parents are added later.
+  mutable std::vector<const DiscreteNode*> discrete_parents_;
+  mutable std::vector<const Node*> continuous_parents_;
+  mutable std::vector<int> discrete_strides_;
+  mutable int num_cached_parents_;
+  mutable bool is_valid_;
+  bool has_variance_per_beta_;
+
+  void SplitParents() const;
+  int GetConfiguration() const;
+  double GetMean(int configuration) const;
+
+  public:
+  ConditionalGaussianNode(const std::vector<std::vector<double>>& betas,
+                          const std::vector<double>& sigma2s,
+                          const std::string& debug_name = "anon_conditional_gaussian");
+  double GetConditional() const override;
+  double GetLogConditional() const override;
+  double GetSample() override;
+  void Seed(uint64_t seed) override;
+  void SaveState(sampler::StateWriter* writer) const override;
+  bool LoadState(sampler::StateReader* reader) override;
+  void AddLogConditionalsOverParentStates(Node* parent,
+                                          int num_states,
+                                          double* log_densities) const override;
+
+  // False if betas and sigma2s differ in length, there is not one of each
+  // per discrete parent configuration, or a beta does not hold one
+  // coefficient per continuous parent plus the intercept. Like an invalid
+  // DiscreteNode, an invalid node has conditional 0 and keeps its value,
+  // and engines refuse to run models containing one.
+  bool IsValid() const;
 };
 
 class GaussianEvidenceNode : public GaussianNode {
@@ -98,18 +260,34 @@ class UniformNode : public ContinuousNode {
   UniformNode(double from, double to, const std::string& debug_name = "anon_uniform");
   double GetConditional() const override;
   double GetSample() override;
+  void Seed(uint64_t seed) override;
+  void SaveState(sampler::StateWriter* writer) const override;
+  bool LoadState(sampler::StateReader* reader) override;
+  double GetFrom() const;
+  double GetTo() const;
   
   private:
   double from_;
   double to_;
+  UniformSource uniform_source_;
 };
 
 class ProposalDensity1D {
   public:
+  virtual ~ProposalDensity1D() {}
+  virtual void Seed(uint64_t seed) {}
+  virtual void SaveState(sampler::StateWriter* writer) const {}
+  virtual bool LoadState(sampler::StateReader* reader) { return true; }
   virtual double Draw(double current_value) = 0; 
   virtual double GetUnnormalizedTransitionProbability(double from, double to) const = 0;
+  // Log of GetUnnormalizedTransitionProbability(); override where it can
+  // be computed without underflowing.
+  virtual double GetLogTransitionProbability(double from, double to) const;
 };
 
+// Random walk step current + N(0, s^2). Note that sigma2 is used as the
+// step's standard deviation s, not its variance (GaussianSource takes a
+// standard deviation); GaussianProposalDensityND's sigma2 is a variance.
 class GaussianProposalDensity1D : public ProposalDensity1D {
   private:
   double half_inv_sigma2_;
@@ -118,28 +296,96 @@ class GaussianProposalDensity1D : public ProposalDensity1D {
 
   public:
   GaussianProposalDensity1D(double sigma2);
+  void Seed(uint64_t seed) override;
+  void SaveState(sampler::StateWriter* writer) const override;
+  bool LoadState(sampler::StateReader* reader) override;
   double Draw(double current_value) override;
   double GetUnnormalizedTransitionProbability(double from, double to) const override;
+  double GetLogTransitionProbability(double from, double to) const override;
+};
+
+// Joint proposal for a block of nodes updated together.
+class ProposalDensityND {
+  public:
+  virtual ~ProposalDensityND() {}
+  virtual int GetDimension() const = 0;
+  virtual void Draw(const std::vector<double>& current_values,
+                    std::vector<double>* proposal) = 0;
+  // log q(to | from), up to a constant.
+  virtual double GetLogTransitionProbability(const std::vector<double>& from,
+                                             const std::vector<double>& to) const = 0;
+  // Adaptation hooks; no-ops for proposals that do not learn.
+  virtual void Accumulate(const std::vector<double>& sample) {}
+  virtual void Adapt() {}
+  virtual void Seed(uint64_t seed) {}
+  virtual void SaveState(sampler::StateWriter* writer) const {}
+  virtual bool LoadState(sampler::StateReader* reader) { return true; }
+};
+
+// Random walk proposal N(current, S) with S = L * L^T. S starts at
+// sigma2 * I, so sigma2 is a variance here; Adapt() replaces it with 2.38^2 / dim times the covariance of
+// the samples Accumulate()'d so far, which is near optimal for Gaussian
+// targets (Haario et al.).
+class GaussianProposalDensityND : public ProposalDensityND {
+  private:
+  int dim_;
+  // Lower triangular Cholesky factor of S, row-major dim_ x dim_.
+  std::vector<double> cholesky_;
+  // Running mean and co-moment of accumulated samples (Welford).
+  std::vector<double> sample_mean_;
+  std::vector<double> sample_comoment_;
+  int num_samples_;
+  std::vector<double> draw_buffer_;
+  GaussianSource standard_normal_;
+
+  public:
+  GaussianProposalDensityND(int dim, double sigma2);
+  int GetDimension() const override;
+  void Draw(const std::vector<double>& current_values,
+            std::vector<double>* proposal) override;
+  double GetLogTransitionProbability(const std::vector<double>& from,
+                                     const std::vector<double>& to) const override;
+  void Accumulate(const std::vector<double>& sample) override;
+  void Adapt() override;
+  void Seed(uint64_t seed) override;
+  void SaveState(sampler::StateWriter* writer) const override;
+  bool LoadState(sampler::StateReader* reader) override;
 };
 
 class Sampler;
 
 class Worker {
   public:
+  virtual ~Worker() {}
   virtual void Reset() = 0;
   virtual void Sample(Sampler* sampler) = 0;
+  // Summary of everything accumulated since the last Reset().
+  virtual std::string ToJsonString() const = 0;
+  // Checkpointing of accumulators; stateless Workers need not override.
+  virtual void SaveState(sampler::StateWriter* writer) const {}
+  virtual bool LoadState(sampler::StateReader* reader) { return true; }
+  // Fills the worker fields of summary for shared-memory publishing.
+  // Returns false if this Worker has nothing to publish.
+  virtual bool GetSummary(sampler::PosteriorSummary* summary) const { return false; }
 };
 
 class HistogramWorker : public Worker {
   sampler::Histogram histogram_;
   int node_idx_;
+  // Running moments of the samples (Welford).
+  int64_t num_samples_;
+  double mean_;
+  double sum_squared_deviations_;
   public:
   HistogramWorker(double range_start, double range_end, int num_bins, int node_idx);
 
   void Sample(Sampler* sampler) override;
   void Reset() override;
 
-  std::string ToJsonString() const;
+  std::string ToJsonString() const override;
+  void SaveState(sampler::StateWriter* writer) const override;
+  bool LoadState(sampler::StateReader* reader) override;
+  bool GetSummary(sampler::PosteriorSummary* summary) const override;
 };
 
 class Sampler {
@@ -149,38 +395,200 @@ class Sampler {
   std::vector<std::unique_ptr<Node>> all_nodes_;
   std::unique_ptr<Worker> worker_;
   bool is_initialized_;
+  sampler::Scheduler* scheduler_;
+  // Set only when GetScheduler() had to create a Scheduler itself.
+  std::unique_ptr<sampler::Scheduler> owned_scheduler_;
+  const sampler::CancellationToken* cancellation_token_;
+  double inverse_temperature_;
+  bool is_verbose_;
+  uint64_t seed_;
+  int64_t num_sweeps_;
+  std::unique_ptr<sampler::Checkpointer> checkpointer_;
+  int checkpoint_interval_;
+  std::unique_ptr<sampler::SharedPosteriorPublisher> publisher_;
+  int publish_interval_;
+  // Reused by every Publish() so publishing does not allocate.
+  sampler::PosteriorSummary summary_;
+
+  void Publish();
 
   public:
+  Sampler();
+  virtual ~Sampler() {}
   // Transfers ownership of Node to Sampler.
   int Register(Node* node);
   // Transfers ownership of Worker to Sampler.
   void Register(Worker* worker);
-  void Reset();
+  virtual void Reset();
   virtual void Infer(int num_iterations) = 0;
-  Node* GetNode(int registration_idx);
+  virtual Node* GetNode(int registration_idx);
+  virtual int GetNumNodes() const;
   Worker* GetWorker();
 
+  // Targets prior * likelihood^inverse_temperature, where the likelihood
+  // is the product of the evidence nodes' conditionals. 1.0 (the default)
+  // is the posterior; smaller values flatten it.
+  virtual void SetInverseTemperature(double inverse_temperature);
+  double GetInverseTemperature() const;
+
+  // Does not transfer ownership; scheduler must outlive the Sampler.
+  // Lets several Samplers share one set of threads.
+  void SetScheduler(sampler::Scheduler* scheduler);
+  // Returns the injected Scheduler, creating a default owned one if none.
+  sampler::Scheduler* GetScheduler();
+  // Does not transfer ownership. Infer() stops at the next sweep boundary
+  // once token is cancelled.
+  void SetCancellationToken(const sampler::CancellationToken* token);
+  // Reseeds every random stream of the chain: node i's from
+  // DeriveSeed(node seed, i), the engine's from a seed of their own, both
+  // derived from seed. Without a call, Samplers take distinct seeds in
+  // construction order, so runs are reproducible and no two Samplers in a
+  // process share a sequence. Snapshot() carries the seed along with the
+  // stream states.
+  void SetSeed(uint64_t seed);
+  uint64_t GetSeed() const;
+  // Whether Infer() reports progress on std::cerr. Defaults to true.
+  // Errors are reported either way.
+  void SetVerbose(bool verbose);
+  bool IsVerbose() const;
+
+  // Sweeps completed since construction, carried across Restore().
+  int64_t GetNumSweeps() const;
+  // Full chain state: node values, every random stream, adaptation state
+  // and Worker accumulators.
+  std::string Snapshot() const;
+  // Restores a Snapshot() taken from a Sampler built with the same model.
+  // Continuing with Infer() then reproduces the original run exactly; do
+  // not call Reset() in between. Returns false, possibly leaving partial
+  // state, if snapshot does not match this model.
+  bool Restore(const std::string& snapshot);
+  bool RestoreFromFile(const std::string& path);
+  // Every interval sweeps, copies a Snapshot() and writes it to path on
+  // a dedicated writer thread. A non-positive interval disables checkpoints.
+  void EnableCheckpoints(const std::string& path, int interval);
+  // Blocks until the last requested checkpoint is on disk.
+  void FlushCheckpoints();
+  // Every interval sweeps, publishes the Worker's summary and diagnostics
+  // to the shared-memory region shm_name (see SharedPosteriorReader), for
+  // histograms of up to max_bins bins. A non-positive interval stops
+  // publishing and removes the region.
+  void EnablePublishing(const std::string& shm_name, int max_bins, int interval);
+
+  // Fraction of accepted proposals since Reset(); 1 for engines that draw
+  // exactly from their conditionals.
+  virtual double GetAcceptanceRate() const;
+
   protected:
   const std::vector<Node*>& NonEvidenceNodes() const;
+  // False, naming the node, if a registered DiscreteNode or
+  // ConditionalGaussianNode is not IsValid(), or a DiscreteNode is not
+  // DiscreteNode::HasValidState(). Engines check it before sampling.
+  bool HasValidDiscreteNodes() const;
+  bool IsCancelled() const;
+  // Engines call this after every sweep. Feeds the Worker, then does the
+  // bookkeeping of CompleteSweeps(1).
+  bool EndSweep();
+  // Counts num_sweeps finished sweeps whose samples already reached the
+  // Worker, takes any checkpoint that fell due, and returns false if
+  // inference should stop early. Engines that feed the Worker themselves
+  // call this once the whole chain state is consistent.
+  bool CompleteSweeps(int num_sweeps);
+  // Scales an evidence node's log conditional by the inverse temperature.
+  double TemperedLogConditional(const Node* node) const;
+  // Seeds the engine's own streams (proposals, accept/reject draws) from
+  // engine_seed. Called by SetSeed(); engines creating streams later, such
+  // as blocks, seed them from GetEngineSeed() themselves.
+  virtual void SeedEngine(uint64_t engine_seed) {}
+  uint64_t GetEngineSeed() const;
+  // Engine-specific state beyond nodes and Worker, e.g. proposal streams.
+  virtual void SaveEngineState(sampler::StateWriter* writer) const {}
+  virtual bool LoadEngineState(sampler::StateReader* reader) { return true; }
 };
 
 class MetroSampler : public Sampler {
   private:
-  std::unique_ptr<ProposalDensity1D> proposal_density_;
+  struct Block {
+    std::vector<Node*> nodes;
+    // Block nodes plus every child of a block node, without duplicates.
+    std::vector<Node*> markov_blanket;
+    std::unique_ptr<ProposalDensityND> proposal_density;
+    std::vector<double> original;
+    std::vector<double> proposal;
+  };
 
+  std::unique_ptr<ProposalDensity1D> proposal_density_;
+  std::vector<std::unique_ptr<Block>> blocks_;
+  std::vector<std::unique_ptr<sampler::GaussianSubnetwork>> exact_blocks_;
+  // Non-evidence nodes that are not in any block, split by update kind.
+  std::vector<Node*> scalar_nodes_;
+  std::vector<DiscreteNode*> discrete_nodes_;
+  int num_adaptation_iterations_;
+  int num_adapted_iterations_;
+  int64_t num_proposals_;
+  int64_t num_accepted_proposals_;
+  UniformSource uniform_source_;
+
+  bool AddBlockNodes(const std::vector<Node*>& nodes, ProposalDensityND* proposal);
+  bool GetUnblockedNodes(const std::vector<int>& node_idxs, std::vector<Node*>* nodes);
+  void BlockStep(Block* block);
+  double GetBlockLogLikelihood(Block* block, const std::vector<double>& values);
   void MetroStep(Node* node);
-  double GetLikelihoodRatio(Node* node, double proposal, double original);
-  double GetTransitionProbabilityRatio(Node* node,
-                                       double proposal,
-                                       double original);
-  double GetUnnormalizedLikelihood(Node* node, double value);
+  double GetLogLikelihoodRatio(Node* node, double proposal, double original);
+  double GetLogTransitionProbabilityRatio(double proposal, double original);
+  double GetUnnormalizedLogLikelihood(Node* node, double value);
+
+  protected:
+  void SeedEngine(uint64_t engine_seed) override;
+  void SaveEngineState(sampler::StateWriter* writer) const override;
+  bool LoadEngineState(sampler::StateReader* reader) override;
   
   public:
   MetroSampler(ProposalDensity1D* proposal);
+  ~MetroSampler() override;
+  void Reset() override;
   void Infer(int num_iterations) override;
+  void SetInverseTemperature(double inverse_temperature) override;
+  // Over scalar and block Metropolis steps.
+  double GetAcceptanceRate() const override;
+
+  // Infer() is Prepare() followed by Sweep() and EndSweep() per iteration.
+  // Engines that drive MetroSamplers as replicas call these directly;
+  // Prepare() must follow any change to the blocks. It returns false, and
+  // Sweep() must not be called, if the model has an invalid DiscreteNode.
+  bool Prepare();
+  // Updates every non-evidence node once. Does not feed the Worker.
+  void Sweep();
+
+  // Updates the nodes at the given Register() indices jointly instead of
+  // one at a time. Transfers ownership of proposal, whose dimension must
+  // match node_idxs.size(). Returns false, adding nothing, if node_idxs is
+  // empty or an index is out of range, repeated, evidence, a DiscreteNode
+  // (which takes Gibbs steps instead) or already in a block.
+  bool AddBlock(const std::vector<int>& node_idxs, ProposalDensityND* proposal);
+  // Groups non-evidence nodes that are not yet blocked into connected
+  // blocks of at most max_block_size nodes, each with a
+  // GaussianProposalDensityND(size, sigma2), sigma2 being a variance.
+  void AddAutomaticBlocks(int max_block_size, double sigma2);
+  // Replaces Metropolis steps for the given latent GaussianNodes with an
+  // exact joint draw from their Gaussian conditional each sweep (see
+  // GaussianSubnetwork). Returns false if the nodes do not qualify, under
+  // the same rules as AddBlock() or IsLinearGaussian().
+  bool AddExactGaussianBlock(const std::vector<int>& node_idxs);
+  // Block proposals learn their covariance over the first num_iterations
+  // sweeps, counted across Infer() calls. Adaptation breaks detailed
+  // balance, so samples drawn meanwhile should be treated as burn-in.
+  void SetAdaptationIterations(int num_iterations);
 };
 
+// Gibbs sampling for networks whose non-evidence nodes are all
+// DiscreteNodes. For mixed graphs use MetroSampler, which applies the same
+// enumeration update to its discrete nodes.
 class GibbsSampler : public Sampler {
+  private:
+  std::vector<DiscreteNode*> discrete_nodes_;
+
+  public:
+  void Infer(int num_iterations) override;
 };
 
 #endif // FRAMEWORK_H
@@ -0,0 +1,201 @@
+#include <memory>
+#include <vector>
+
+#include "framework.h"
+#include "shared_posterior.h"
+#include "test_util.h"
+
+namespace {
+
+const int kNumStatesA = 2;
+const int kNumStatesB = 3;
+
+// a -> b, and evidence c with parents a and b observed in state 1. A
+// HistogramWorker with one unit-wide bin per state counts the states of
+// the node it watches.
+struct Network {
+  DiscreteNode* a;
+  DiscreteNode* b;
+  DiscreteNode* c;
+  int a_idx;
+  int b_idx;
+};
+
+Network AddNetwork(Sampler* sampler) {
+  Network network;
+  network.a = new DiscreteNode(kNumStatesA, {0.4, 0.6}, "a");
+  network.b = new DiscreteNode(kNumStatesB, {0.5, 0.3, 0.2,
+                                             0.1, 0.3, 0.6}, "b");
+  network.c = new DiscreteEvidenceNode(2, {0.9, 0.1,
+                                           0.6, 0.4,
+                                           0.3, 0.7,
+                                           0.8, 0.2,
+                                           0.5, 0.5,
+                                           0.05, 0.95}, 1, "c");
+  network.b->EdgeFrom(network.a);
+  network.c->EdgeFrom(network.a);
+  network.c->EdgeFrom(network.b);
+  network.a_idx = sampler->Register(network.a);
+  network.b_idx = sampler->Register(network.b);
+  sampler->Register(network.c);
+  return network;
+}
+
+// Posterior marginals of a and b given c, by summing the product of the
+// nodes' own conditionals over every joint state.
+void Enumerate(const Network& network,
+               std::vector<double>* marginal_a,
+               std::vector<double>* marginal_b) {
+  marginal_a->assign(kNumStatesA, 0.0);
+  marginal_b->assign(kNumStatesB, 0.0);
+  double total = 0.0;
+  for (int a = 0; a < kNumStatesA; ++a) {
+    for (int b = 0; b < kNumStatesB; ++b) {
+      network.a->SetValue(a);
+      network.b->SetValue(b);
+      const double joint = network.a->GetConditional() *
+                           network.b->GetConditional() *
+                           network.c->GetConditional();
+      (*marginal_a)[a] += joint;
+      (*marginal_b)[b] += joint;
+      total += joint;
+    }
+  }
+  for (double& p : *marginal_a) {
+    p /= total;
+  }
+  for (double& p : *marginal_b) {
+    p /= total;
+  }
+}
+
+void ExpectMarginal(Sampler* sampler, const std::vector<double>& marginal) {
+  sampler::PosteriorSummary summary;
+  EXPECT_TRUE(sampler->GetWorker()->GetSummary(&summary));
+  EXPECT_TRUE(summary.num_bins == marginal.size());
+  for (int state = 0; state < marginal.size() && state < summary.num_bins; ++state) {
+    const double frequency = static_cast<double>(summary.counts[state + 1]) / summary.num_samples;
+    EXPECT_NEAR(frequency, marginal[state], 0.015);
+  }
+}
+
+// Runs the network on an empty sampler and compares the sampled marginal of
+// the node at node_offset (0 for a, 1 for b) with enumeration.
+template <typename SamplerType>
+void TestAgainstEnumeration(SamplerType* sampler, int node_offset) {
+  const int kNumIterations = 40000;
+  sampler->SetVerbose(false);
+  Network network = AddNetwork(sampler);
+  std::vector<double> marginal_a;
+  std::vector<double> marginal_b;
+  Enumerate(network, &marginal_a, &marginal_b);
+  const std::vector<double>& marginal = node_offset == 0 ? marginal_a : marginal_b;
+  sampler->Register(new HistogramWorker(-0.5, marginal.size() - 0.5, marginal.size(),
+                                        network.a_idx + node_offset));
+  sampler->Reset();
+  sampler->Infer(kNumIterations);
+  ExpectMarginal(sampler, marginal);
+}
+
+void TestRejectsInvalidTables() {
+  GibbsSampler sampler;
+  sampler.SetVerbose(false);
+  DiscreteNode* a = new DiscreteNode(2, {0.4, 0.6}, "a");
+  // One row short for a two-state parent.
+  DiscreteNode* b = new DiscreteEvidenceNode(2, {0.5, 0.5}, 1, "b");
+  b->EdgeFrom(a);
+  sampler.Register(a);
+  sampler.Register(b);
+  EXPECT_TRUE(a->IsValid());
+  EXPECT_TRUE(!b->IsValid());
+  a->SetValue(1.0);
+  sampler.Infer(10);
+  EXPECT_TRUE(a->GetState() == 1);
+  EXPECT_TRUE(sampler.GetNumSweeps() == 0);
+}
+
+// Evidence outside the states, whether given at construction or set
+// later as BatchQueryRunner does, must stop the engines before they index
+// the table with it.
+void TestRejectsEvidenceOutsideStates() {
+  DiscreteEvidenceNode bad(2, {0.4, 0.6}, 5, "bad");
+  EXPECT_TRUE(!bad.HasValidState());
+
+  for (double value : {5.0, -40000.0, 0.5}) {
+    MetroSampler sampler(new GaussianProposalDensity1D(0.5));
+    sampler.SetVerbose(false);
+    DiscreteNode* a = new DiscreteNode(2, {0.4, 0.6}, "a");
+    DiscreteNode* b = new DiscreteEvidenceNode(2, {0.5, 0.5, 0.1, 0.9}, 1, "b");
+    b->EdgeFrom(a);
+    const int a_idx = sampler.Register(a);
+    sampler.Register(b);
+    sampler.Register(new HistogramWorker(-0.5, 1.5, 2, a_idx));
+    EXPECT_TRUE(b->HasValidState());
+    b->SetValue(value);
+    EXPECT_TRUE(!b->HasValidState());
+    sampler.Reset();
+    sampler.Infer(10);
+    EXPECT_TRUE(sampler.GetNumSweeps() == 0);
+  }
+}
+
+void TestRejectsDiscreteBlockNodes() {
+  MetroSampler sampler(new GaussianProposalDensity1D(0.5));
+  sampler.SetVerbose(false);
+  const int a_idx = sampler.Register(new DiscreteNode(2, {0.4, 0.6}, "a"));
+  const int x_idx = sampler.Register(new GaussianNode({0.0}, 1.0, "x"));
+  EXPECT_TRUE(!sampler.AddBlock({a_idx, x_idx}, new GaussianProposalDensityND(2, 0.1)));
+  EXPECT_TRUE(!sampler.AddExactGaussianBlock({a_idx}));
+}
+
+// A ConditionalGaussianNode needs one parameter set per discrete parent
+// configuration, each with one coefficient per continuous parent.
+void TestRejectsInvalidConditionalGaussians() {
+  struct Case {
+    std::vector<std::vector<double>> betas;
+    std::vector<double> sigma2s;
+    bool is_valid;
+  };
+  const Case cases[] = {
+    {{{0.0, 1.0}, {1.0, 1.0}, {2.0, 1.0}}, {1.0, 1.0, 1.0}, true},
+    // Two parameter sets under a three-state parent.
+    {{{0.0, 1.0}, {1.0, 1.0}}, {1.0, 1.0}, false},
+    // Missing the coefficient of x.
+    {{{0.0}, {1.0, 1.0}, {2.0, 1.0}}, {1.0, 1.0, 1.0}, false},
+    // One variance short.
+    {{{0.0, 1.0}, {1.0, 1.0}, {2.0, 1.0}}, {1.0, 1.0}, false},
+  };
+  for (const Case& c : cases) {
+    MetroSampler sampler(new GaussianProposalDensity1D(0.5));
+    sampler.SetVerbose(false);
+    DiscreteNode* a = new DiscreteNode(3, {0.2, 0.3, 0.5}, "a");
+    Node* x = new GaussianNode({0.0}, 1.0, "x");
+    ConditionalGaussianNode* y = new ConditionalGaussianNode(c.betas, c.sigma2s, "y");
+    y->EdgeFrom(a);
+    y->EdgeFrom(x);
+    const int a_idx = sampler.Register(a);
+    sampler.Register(x);
+    sampler.Register(y);
+    sampler.Register(new HistogramWorker(-0.5, 2.5, 3, a_idx));
+    EXPECT_TRUE(y->IsValid() == c.is_valid);
+    sampler.Reset();
+    sampler.Infer(10);
+    EXPECT_TRUE(sampler.GetNumSweeps() == (c.is_valid ? 10 : 0));
+  }
+}
+
+}  // namespace
+
+int main() {
+  for (int node_offset = 0; node_offset < 2; ++node_offset) {
+    GibbsSampler gibbs;
+    TestAgainstEnumeration(&gibbs, node_offset);
+    MetroSampler metro(new GaussianProposalDensity1D(0.5));
+    TestAgainstEnumeration(&metro, node_offset);
+  }
+  TestRejectsInvalidTables();
+  TestRejectsEvidenceOutsideStates();
+  TestRejectsDiscreteBlockNodes();
+  TestRejectsInvalidConditionalGaussians();
+  return sampler::testing::TestResult();
+}
@@ -73,4 +73,24 @@ void Histogram::Reset() {
   }
 }
 
+double Histogram::GetRangeStart() const {
+  return range_start_;
+}
+
+double Histogram::GetRangeEnd() const {
+  return range_end_;
+}
+
+const vector<int>& Histogram::GetCounts() const {
+  return counts_;
+}
+
+bool Histogram::SetCounts(const vector<int>& counts) {
+  if (counts.size() != counts_.size()) {
+    return false;
+  }
+  counts_ = counts;
+  return true;
+}
+
 }  // namespace sampler
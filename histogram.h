@@ -13,6 +13,11 @@ class Histogram {
   std::string ToString() const;
   std::string ToJsonString() const;
   void Reset();
+  double GetRangeStart() const;
+  double GetRangeEnd() const;
+  const std::vector<int>& GetCounts() const;
+  // Returns false, leaving the counts unchanged, if counts has the wrong size.
+  bool SetCounts(const std::vector<int>& counts);
 
   protected:
   double range_start_;
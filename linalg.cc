@@ -0,0 +1,52 @@
+#include <cmath>
+
+#include "linalg.h"
+
+namespace sampler {
+
+bool CholeskyDecompose(int dim, std::vector<double>* a) {
+  std::vector<double>& m = *a;
+  for (int j = 0; j < dim; ++j) {
+    double diagonal = m[j * dim + j];
+    for (int k = 0; k < j; ++k) {
+      diagonal -= m[j * dim + k] * m[j * dim + k];
+    }
+    if (!(diagonal > 0.0)) {
+      return false;
+    }
+    m[j * dim + j] = sqrt(diagonal);
+    for (int i = j + 1; i < dim; ++i) {
+      double off_diagonal = m[i * dim + j];
+      for (int k = 0; k < j; ++k) {
+        off_diagonal -= m[i * dim + k] * m[j * dim + k];
+      }
+      m[i * dim + j] = off_diagonal / m[j * dim + j];
+    }
+    for (int i = 0; i < j; ++i) {
+      m[i * dim + j] = 0.0;
+    }
+  }
+  return true;
+}
+
+void SolveLower(int dim, const std::vector<double>& cholesky, std::vector<double>* b) {
+  std::vector<double>& x = *b;
+  for (int i = 0; i < dim; ++i) {
+    for (int j = 0; j < i; ++j) {
+      x[i] -= cholesky[i * dim + j] * x[j];
+    }
+    x[i] /= cholesky[i * dim + i];
+  }
+}
+
+void SolveLowerTransposed(int dim, const std::vector<double>& cholesky, std::vector<double>* b) {
+  std::vector<double>& x = *b;
+  for (int i = dim - 1; i >= 0; --i) {
+    for (int j = i + 1; j < dim; ++j) {
+      x[i] -= cholesky[j * dim + i] * x[j];
+    }
+    x[i] /= cholesky[i * dim + i];
+  }
+}
+
+}  // namespace sampler
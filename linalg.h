@@ -0,0 +1,24 @@
+#ifndef SAMPLER_LINALG_H_
+#define SAMPLER_LINALG_H_
+
+#include <vector>
+
+namespace sampler {
+
+// Dense helpers for the small row-major dim x dim matrices used by block
+// proposals and exact Gaussian updates.
+
+// In-place Cholesky factorization of a symmetric matrix into its lower
+// triangular factor L, zeroing the strict upper triangle. Returns false,
+// leaving a partially overwritten, if a is not positive definite.
+bool CholeskyDecompose(int dim, std::vector<double>* a);
+
+// Solves L * x = b in place for lower triangular L.
+void SolveLower(int dim, const std::vector<double>& cholesky, std::vector<double>* b);
+
+// Solves L^T * x = b in place for lower triangular L.
+void SolveLowerTransposed(int dim, const std::vector<double>& cholesky, std::vector<double>* b);
+
+}  // namespace sampler
+
+#endif  // SAMPLER_LINALG_H_
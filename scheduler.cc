@@ -0,0 +1,241 @@
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "scheduler.h"
+
+namespace sampler {
+
+namespace {
+
+// Index of the Scheduler worker running on this thread, or -1 elsewhere.
+thread_local int current_worker_idx = -1;
+thread_local const void* current_scheduler = nullptr;
+
+}  // namespace
+
+CancellationToken::CancellationToken() :
+  cancelled_(false)
+{}
+
+void CancellationToken::Cancel() {
+  cancelled_.store(true, std::memory_order_release);
+}
+
+void CancellationToken::Clear() {
+  cancelled_.store(false, std::memory_order_release);
+}
+
+bool CancellationToken::IsCancelled() const {
+  return cancelled_.load(std::memory_order_acquire);
+}
+
+TaskGroup::TaskGroup() :
+  pending_(0),
+  queued_(0)
+{}
+
+bool TaskGroup::IsDone() const {
+  return pending_.load(std::memory_order_acquire) == 0;
+}
+
+SchedulerOptions::SchedulerOptions() :
+  num_workers(0)
+{}
+
+std::vector<int> CpusOfNumaNode(int numa_node) {
+  std::vector<int> cpus;
+  std::ostringstream path;
+  path << "/sys/devices/system/node/node" << numa_node << "/cpulist";
+  std::ifstream cpulist(path.str());
+  std::string range;
+  // Format is a comma separated list of "a" or "a-b" entries.
+  while (std::getline(cpulist, range, ',')) {
+    int from = 0;
+    int to = 0;
+    char dash = 0;
+    std::istringstream iss(range);
+    if (!(iss >> from)) {
+      continue;
+    }
+    to = from;
+    if (iss >> dash >> to && dash != '-') {
+      to = from;
+    }
+    for (int cpu = from; cpu <= to; ++cpu) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+
+Scheduler::Scheduler(const SchedulerOptions& options) :
+  num_queued_(0),
+  next_queue_(0),
+  stopping_(false)
+{
+  int num_workers = options.num_workers;
+  if (num_workers <= 0) {
+    num_workers = std::thread::hardware_concurrency();
+  }
+  if (num_workers <= 0) {
+    num_workers = 1;
+  }
+
+  for (int i = 0; i < num_workers; ++i) {
+    queues_.emplace_back(new WorkerQueue);
+  }
+  for (int i = 0; i < num_workers; ++i) {
+    threads_.emplace_back(&Scheduler::WorkerLoop, this, i);
+    if (!options.cpu_ids.empty()) {
+      PinToCpu(&threads_.back(), options.cpu_ids[i % options.cpu_ids.size()]);
+    }
+  }
+}
+
+Scheduler::~Scheduler() {
+  {
+    std::lock_guard<std::mutex> lock(idle_mutex_);
+    stopping_ = true;
+  }
+  idle_cv_.notify_all();
+  for (std::thread& thread : threads_) {
+    thread.join();
+  }
+}
+
+int Scheduler::GetNumWorkers() const {
+  return threads_.size();
+}
+
+void Scheduler::PinToCpu(std::thread* thread, int cpu_id) {
+#ifdef __linux__
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  CPU_SET(cpu_id, &cpu_set);
+  if (pthread_setaffinity_np(thread->native_handle(), sizeof(cpu_set), &cpu_set) != 0) {
+    std::cerr << "Scheduler::PinToCpu failed to pin worker to cpu " << cpu_id << std::endl;
+  }
+#else
+  std::cerr << "Scheduler::PinToCpu not supported on this platform" << std::endl;
+#endif
+}
+
+void Scheduler::Submit(const Task& task, TaskGroup* group) {
+  group->pending_.fetch_add(1, std::memory_order_relaxed);
+
+  int queue_idx = current_worker_idx;
+  if (current_scheduler != this || queue_idx < 0) {
+    queue_idx = next_queue_++ % queues_.size();
+  }
+  {
+    std::lock_guard<std::mutex> lock(queues_[queue_idx]->mutex);
+    queues_[queue_idx]->tasks.push_back(QueuedTask{task, group});
+  }
+  {
+    // Taking the idle mutex orders these increments against a thread that
+    // is about to check them and go to sleep.
+    std::lock_guard<std::mutex> lock(idle_mutex_);
+    ++num_queued_;
+    ++group->queued_;
+  }
+  idle_cv_.notify_one();
+  // A thread waiting on group may be the only one free to run the task.
+  wait_cv_.notify_all();
+}
+
+namespace {
+
+// Index of the task to take from tasks, searching from the back (own
+// deque) or the front (stealing), or -1. Any task matches a null group.
+template <typename Deque, typename Group>
+int FindTask(const Deque& tasks, bool from_back, const Group* group) {
+  const int num_tasks = tasks.size();
+  for (int i = 0; i < num_tasks; ++i) {
+    const int idx = from_back ? num_tasks - 1 - i : i;
+    if (group == nullptr || tasks[idx].group == group) {
+      return idx;
+    }
+  }
+  return -1;
+}
+
+}  // namespace
+
+bool Scheduler::PopOrSteal(int worker_idx, const TaskGroup* group, QueuedTask* task) {
+  if (num_queued_.load(std::memory_order_acquire) == 0 ||
+      (group != nullptr && group->queued_.load(std::memory_order_acquire) == 0)) {
+    return false;
+  }
+  const int num_queues = queues_.size();
+  const int start = worker_idx >= 0 ? worker_idx : 0;
+  for (int i = 0; i < num_queues; ++i) {
+    const int queue_idx = (start + i) % num_queues;
+    const bool is_own = queue_idx == worker_idx;
+    WorkerQueue* queue = queues_[queue_idx].get();
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    const int task_idx = FindTask(queue->tasks, is_own, group);
+    if (task_idx >= 0) {
+      *task = std::move(queue->tasks[task_idx]);
+      queue->tasks.erase(queue->tasks.begin() + task_idx);
+      --num_queued_;
+      --task->group->queued_;
+      return true;
+    }
+  }
+  return false;
+}
+
+void Scheduler::RunTask(QueuedTask* task) {
+  task->task();
+  if (task->group->pending_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    // Wake any thread blocked in Wait() on this group.
+    std::lock_guard<std::mutex> lock(idle_mutex_);
+    wait_cv_.notify_all();
+  }
+}
+
+void Scheduler::WorkerLoop(int worker_idx) {
+  current_worker_idx = worker_idx;
+  current_scheduler = this;
+  QueuedTask task;
+  while (true) {
+    if (PopOrSteal(worker_idx, nullptr, &task)) {
+      RunTask(&task);
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(idle_mutex_);
+    idle_cv_.wait(lock, [this]() { return stopping_ || num_queued_ > 0; });
+    if (stopping_ && num_queued_ == 0) {
+      return;
+    }
+  }
+}
+
+void Scheduler::Wait(TaskGroup* group) {
+  const int worker_idx = current_scheduler == this ? current_worker_idx : -1;
+  QueuedTask task;
+  while (!group->IsDone()) {
+    if (PopOrSteal(worker_idx, group, &task)) {
+      RunTask(&task);
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(idle_mutex_);
+    wait_cv_.wait(lock, [group]() { return group->IsDone() || group->queued_ > 0; });
+  }
+}
+
+void Scheduler::ParallelFor(int n, const std::function<void(int)>& body) {
+  TaskGroup group;
+  for (int i = 0; i < n; ++i) {
+    Submit([&body, i]() { body(i); }, &group);
+  }
+  Wait(&group);
+}
+
+}  // namespace sampler
@@ -0,0 +1,112 @@
+#ifndef SAMPLER_SCHEDULER_H_
+#define SAMPLER_SCHEDULER_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace sampler {
+
+// Cooperative stop signal. Engines poll it between sweeps, so a cancelled
+// Infer() returns after finishing the sweep in progress.
+class CancellationToken {
+  public:
+  CancellationToken();
+  void Cancel();
+  void Clear();
+  bool IsCancelled() const;
+
+  private:
+  std::atomic<bool> cancelled_;
+};
+
+// Counts outstanding tasks submitted under one group so callers can wait
+// for exactly the work they issued.
+class TaskGroup {
+  public:
+  TaskGroup();
+  bool IsDone() const;
+
+  private:
+  friend class Scheduler;
+  // Tasks submitted and not yet finished.
+  std::atomic<int> pending_;
+  // Of those, tasks still sitting in a deque.
+  std::atomic<int> queued_;
+};
+
+struct SchedulerOptions {
+  SchedulerOptions();
+
+  // Number of worker threads; 0 uses std::thread::hardware_concurrency().
+  int num_workers;
+  // Worker i is pinned to cpu_ids[i % cpu_ids.size()]. Empty disables
+  // pinning. See CpusOfNumaNode() to keep all workers on one NUMA node.
+  std::vector<int> cpu_ids;
+};
+
+// CPUs listed by /sys/devices/system/node/node<numa_node>/cpulist, or an
+// empty vector if the node does not exist or the platform has no NUMA info.
+std::vector<int> CpusOfNumaNode(int numa_node);
+
+// Fixed-size work-stealing thread pool shared by every inference engine.
+// Each worker owns a deque: it pushes and pops its own work at the back and
+// idle workers steal from the front of the others.
+class Scheduler {
+  public:
+  typedef std::function<void()> Task;
+
+  explicit Scheduler(const SchedulerOptions& options = SchedulerOptions());
+  ~Scheduler();
+
+  // Queues task under group. Called from a worker thread, the task lands on
+  // that worker's own deque; otherwise deques are filled round-robin.
+  void Submit(const Task& task, TaskGroup* group);
+  // Blocks until every task in group has run. The calling thread executes
+  // queued tasks of group while it waits instead of sleeping, but never
+  // another group's: a sampler joining its own tasks must not pick up an
+  // unrelated, possibly much longer, task and delay its own round.
+  void Wait(TaskGroup* group);
+  // Runs body(0) .. body(n - 1) across the workers and waits for them.
+  void ParallelFor(int n, const std::function<void(int)>& body);
+
+  int GetNumWorkers() const;
+
+  private:
+  struct QueuedTask {
+    Task task;
+    TaskGroup* group;
+  };
+
+  struct WorkerQueue {
+    std::mutex mutex;
+    std::deque<QueuedTask> tasks;
+  };
+
+  void WorkerLoop(int worker_idx);
+  // Takes a task from worker_idx's deque, else steals one. If group is not
+  // null, only tasks of group are taken.
+  bool PopOrSteal(int worker_idx, const TaskGroup* group, QueuedTask* task);
+  void RunTask(QueuedTask* task);
+  void PinToCpu(std::thread* thread, int cpu_id);
+
+  std::vector<std::unique_ptr<WorkerQueue>> queues_;
+  std::vector<std::thread> threads_;
+  std::atomic<int> num_queued_;
+  std::atomic<unsigned> next_queue_;
+  std::atomic<bool> stopping_;
+  std::mutex idle_mutex_;
+  // Idle workers sleep on idle_cv_, threads in Wait() on wait_cv_; both
+  // use idle_mutex_.
+  std::condition_variable idle_cv_;
+  std::condition_variable wait_cv_;
+};
+
+}  // namespace sampler
+
+#endif  // SAMPLER_SCHEDULER_H_
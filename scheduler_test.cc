@@ -0,0 +1,135 @@
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "framework.h"
+#include "scheduler.h"
+#include "test_util.h"
+
+namespace {
+
+void TestParallelForRunsEachIndexOnce() {
+  sampler::SchedulerOptions options;
+  options.num_workers = 4;
+  sampler::Scheduler scheduler(options);
+  EXPECT_TRUE(scheduler.GetNumWorkers() == 4);
+
+  const int kNumIndices = 10000;
+  std::vector<std::atomic<int>> runs(kNumIndices);
+  for (std::atomic<int>& num_runs : runs) {
+    num_runs.store(0);
+  }
+  scheduler.ParallelFor(kNumIndices, [&runs](int i) { runs[i].fetch_add(1); });
+  int num_wrong = 0;
+  for (const std::atomic<int>& num_runs : runs) {
+    num_wrong += num_runs.load() != 1;
+  }
+  EXPECT_TRUE(num_wrong == 0);
+
+  scheduler.ParallelFor(0, [](int i) {});
+}
+
+void TestNestedSubmitAndWait() {
+  sampler::SchedulerOptions options;
+  options.num_workers = 3;
+  sampler::Scheduler scheduler(options);
+
+  // Each outer task fans out from a worker thread and waits on its own
+  // group, so workers must run queued tasks while they wait.
+  const int kNumOuter = 16;
+  const int kNumInner = 64;
+  std::atomic<int> num_inner_runs(0);
+  std::atomic<int> num_complete_outer(0);
+  sampler::TaskGroup outer;
+  for (int i = 0; i < kNumOuter; ++i) {
+    scheduler.Submit([&]() {
+      sampler::TaskGroup inner;
+      for (int j = 0; j < kNumInner; ++j) {
+        scheduler.Submit([&num_inner_runs]() { num_inner_runs.fetch_add(1); }, &inner);
+      }
+      scheduler.Wait(&inner);
+      if (inner.IsDone()) {
+        num_complete_outer.fetch_add(1);
+      }
+    }, &outer);
+  }
+  scheduler.Wait(&outer);
+  EXPECT_TRUE(outer.IsDone());
+  EXPECT_TRUE(num_complete_outer.load() == kNumOuter);
+  EXPECT_TRUE(num_inner_runs.load() == kNumOuter * kNumInner);
+}
+
+// Wait() helps with its own group only. With the single worker busy, the
+// waiting thread must run the task it waits for and leave the other
+// group's task, queued ahead of it, to the worker.
+void TestWaitRunsOnlyItsOwnGroup() {
+  sampler::SchedulerOptions options;
+  options.num_workers = 1;
+  sampler::Scheduler scheduler(options);
+
+  std::atomic<bool> is_blocking(false);
+  std::atomic<bool> release(false);
+  sampler::TaskGroup blocker;
+  scheduler.Submit([&is_blocking, &release]() {
+    is_blocking.store(true);
+    while (!release.load()) {
+      std::this_thread::yield();
+    }
+  }, &blocker);
+  while (!is_blocking.load()) {
+    std::this_thread::yield();
+  }
+
+  const std::thread::id waiting_thread = std::this_thread::get_id();
+  std::thread::id foreign_thread;
+  std::thread::id own_thread;
+  sampler::TaskGroup foreign;
+  sampler::TaskGroup own;
+  scheduler.Submit([&foreign_thread]() { foreign_thread = std::this_thread::get_id(); }, &foreign);
+  scheduler.Submit([&own_thread]() { own_thread = std::this_thread::get_id(); }, &own);
+  scheduler.Wait(&own);
+  EXPECT_TRUE(own_thread == waiting_thread);
+  EXPECT_TRUE(!foreign.IsDone());
+
+  // Poll rather than Wait(), which would let this thread run it.
+  release.store(true);
+  while (!foreign.IsDone()) {
+    std::this_thread::yield();
+  }
+  EXPECT_TRUE(foreign_thread != waiting_thread);
+  EXPECT_TRUE(blocker.IsDone());
+}
+
+void TestCancellation() {
+  sampler::CancellationToken token;
+  EXPECT_TRUE(!token.IsCancelled());
+
+  MetroSampler sampler(new GaussianProposalDensity1D(0.5));
+  sampler.SetVerbose(false);
+  const int x_idx = sampler.Register(new GaussianNode({0.0}, 1.0));
+  sampler.Register(new HistogramWorker(-3.0, 3.0, 10, x_idx));
+  sampler.SetCancellationToken(&token);
+  sampler.Reset();
+  sampler.Infer(10);
+  EXPECT_TRUE(sampler.GetNumSweeps() == 10);
+
+  // A cancelled Infer() still finishes the sweep in progress.
+  token.Cancel();
+  EXPECT_TRUE(token.IsCancelled());
+  sampler.Infer(10);
+  EXPECT_TRUE(sampler.GetNumSweeps() == 11);
+
+  token.Clear();
+  sampler.Infer(10);
+  EXPECT_TRUE(sampler.GetNumSweeps() == 21);
+}
+
+}  // namespace
+
+int main() {
+  TestParallelForRunsEachIndexOnce();
+  TestNestedSubmitAndWait();
+  TestWaitRunsOnlyItsOwnGroup();
+  TestCancellation();
+  return sampler::testing::TestResult();
+}
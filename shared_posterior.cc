@@ -0,0 +1,229 @@
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "shared_posterior.h"
+
+namespace sampler {
+
+namespace {
+
+// "HOPPOST1" in ASCII; identifies a region and its layout version.
+const uint64_t kRegionMagic = 0x484f50504f535431ULL;
+
+}  // namespace
+
+// Layout of the mapped region. Only fixed-width fields, so that reader and
+// publisher agree without sharing anything but this definition; counts
+// extends past the struct to max_bins + 2 entries.
+struct SharedPosteriorRegion {
+  uint64_t magic;
+  int64_t max_bins;
+  // Even when the payload is stable; incremented before and after each
+  // write. Lock-free on every platform we build for.
+  std::atomic<uint64_t> sequence;
+
+  double range_start;
+  double range_end;
+  int64_t num_bins;
+  int64_t num_samples;
+  double mean;
+  double variance;
+  int64_t num_sweeps;
+  double acceptance_rate;
+  int64_t counts[1];
+};
+
+static size_t RegionSize(int max_bins) {
+  return sizeof(SharedPosteriorRegion) + (max_bins + 1) * sizeof(int64_t);
+}
+
+PosteriorSummary::PosteriorSummary() :
+  range_start(0.0),
+  range_end(0.0),
+  num_bins(0),
+  num_samples(0),
+  mean(0.0),
+  variance(0.0),
+  num_sweeps(0),
+  acceptance_rate(0.0)
+{}
+
+SharedPosteriorPublisher::SharedPosteriorPublisher(const std::string& name, int max_bins) :
+  name_(name),
+  max_bins_(max_bins),
+  size_(RegionSize(max_bins)),
+  region_(nullptr)
+{
+  int fd = shm_open(name_.c_str(), O_CREAT | O_RDWR, 0644);
+  if (fd < 0) {
+    std::cerr << "SharedPosteriorPublisher cannot create " << name_ << std::endl;
+    return;
+  }
+  if (ftruncate(fd, size_) != 0) {
+    std::cerr << "SharedPosteriorPublisher cannot size " << name_ << std::endl;
+    close(fd);
+    return;
+  }
+  void* memory = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (memory == MAP_FAILED) {
+    std::cerr << "SharedPosteriorPublisher cannot map " << name_ << std::endl;
+    return;
+  }
+  memset(memory, 0, size_);
+  region_ = new (memory) SharedPosteriorRegion;
+  region_->max_bins = max_bins_;
+  region_->sequence.store(0, std::memory_order_relaxed);
+  // Readers check the magic last, so it is only visible once the rest of
+  // the header is.
+  std::atomic_thread_fence(std::memory_order_release);
+  region_->magic = kRegionMagic;
+}
+
+SharedPosteriorPublisher::~SharedPosteriorPublisher() {
+  if (region_ != nullptr) {
+    munmap(region_, size_);
+    shm_unlink(name_.c_str());
+  }
+}
+
+bool SharedPosteriorPublisher::IsOpen() const {
+  return region_ != nullptr;
+}
+
+void SharedPosteriorPublisher::Publish(const PosteriorSummary& summary) {
+  if (region_ == nullptr || summary.num_bins < 0 ||
+      summary.counts.size() != summary.num_bins + 2) {
+    return;
+  }
+  // Bins of the summary merged into each published bin.
+  int group = 1;
+  if (summary.num_bins > max_bins_) {
+    group = max_bins_ > 0 ? (summary.num_bins + max_bins_ - 1) / max_bins_ : summary.num_bins + 1;
+  }
+  const int num_bins = summary.num_bins / group;
+  const double bin_width = summary.num_bins > 0 ?
+      (summary.range_end - summary.range_start) / summary.num_bins : 0.0;
+
+  const uint64_t sequence = region_->sequence.load(std::memory_order_relaxed);
+  region_->sequence.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  region_->range_start = summary.range_start;
+  region_->range_end = num_bins * group == summary.num_bins ?
+      summary.range_end : summary.range_start + num_bins * group * bin_width;
+  region_->num_bins = num_bins;
+  region_->num_samples = summary.num_samples;
+  region_->mean = summary.mean;
+  region_->variance = summary.variance;
+  region_->num_sweeps = summary.num_sweeps;
+  region_->acceptance_rate = summary.acceptance_rate;
+  if (group == 1) {
+    memcpy(region_->counts, summary.counts.data(), (num_bins + 2) * sizeof(int64_t));
+  } else {
+    region_->counts[0] = summary.counts[0];
+    for (int bin = 0; bin < num_bins; ++bin) {
+      int64_t count = 0;
+      for (int i = 1 + bin * group; i < 1 + (bin + 1) * group; ++i) {
+        count += summary.counts[i];
+      }
+      region_->counts[bin + 1] = count;
+    }
+    int64_t overflow = 0;
+    for (int i = 1 + num_bins * group; i < summary.num_bins + 2; ++i) {
+      overflow += summary.counts[i];
+    }
+    region_->counts[num_bins + 1] = overflow;
+  }
+
+  region_->sequence.store(sequence + 2, std::memory_order_release);
+}
+
+SharedPosteriorReader::SharedPosteriorReader(const std::string& name) :
+  size_(0),
+  region_(nullptr)
+{
+  int fd = shm_open(name.c_str(), O_RDONLY, 0);
+  if (fd < 0) {
+    return;
+  }
+  struct stat status;
+  if (fstat(fd, &status) != 0 || status.st_size < sizeof(SharedPosteriorRegion)) {
+    close(fd);
+    return;
+  }
+  size_ = status.st_size;
+  void* memory = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (memory == MAP_FAILED) {
+    return;
+  }
+  region_ = static_cast<const SharedPosteriorRegion*>(memory);
+  if (region_->magic != kRegionMagic || RegionSize(region_->max_bins) > size_) {
+    std::cerr << "SharedPosteriorReader " << name << " is not a posterior region" << std::endl;
+    munmap(const_cast<SharedPosteriorRegion*>(region_), size_);
+    region_ = nullptr;
+  }
+  std::atomic_thread_fence(std::memory_order_acquire);
+}
+
+SharedPosteriorReader::~SharedPosteriorReader() {
+  if (region_ != nullptr) {
+    munmap(const_cast<SharedPosteriorRegion*>(region_), size_);
+  }
+}
+
+bool SharedPosteriorReader::IsOpen() const {
+  return region_ != nullptr;
+}
+
+uint64_t SharedPosteriorReader::GetVersion() const {
+  return region_ == nullptr ? 0 : region_->sequence.load(std::memory_order_acquire) / 2;
+}
+
+bool SharedPosteriorReader::Read(PosteriorSummary* summary, int max_attempts) const {
+  if (region_ == nullptr) {
+    return false;
+  }
+  for (int attempt = 0; attempt < max_attempts; ++attempt) {
+    const uint64_t before = region_->sequence.load(std::memory_order_acquire);
+    if (before == 0) {
+      return false;
+    }
+    if (before % 2 == 1) {
+      std::this_thread::yield();
+      continue;
+    }
+
+    const int num_bins = std::min<int64_t>(region_->num_bins, region_->max_bins);
+    summary->range_start = region_->range_start;
+    summary->range_end = region_->range_end;
+    summary->num_bins = num_bins;
+    summary->num_samples = region_->num_samples;
+    summary->mean = region_->mean;
+    summary->variance = region_->variance;
+    summary->num_sweeps = region_->num_sweeps;
+    summary->acceptance_rate = region_->acceptance_rate;
+    summary->counts.resize(num_bins + 2);
+    memcpy(summary->counts.data(), region_->counts, (num_bins + 2) * sizeof(int64_t));
+
+    // The copy above may have raced with a write; it is only kept if the
+    // sequence number did not move while it was taken.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (region_->sequence.load(std::memory_order_relaxed) == before) {
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace sampler
@@ -0,0 +1,78 @@
+#ifndef SAMPLER_SHARED_POSTERIOR_H_
+#define SAMPLER_SHARED_POSTERIOR_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace sampler {
+
+// Worker summary that can cross a process boundary.
+struct PosteriorSummary {
+  PosteriorSummary();
+
+  // Histogram as in Histogram: counts[0] is below range_start,
+  // counts[num_bins + 1] at or above range_end.
+  double range_start;
+  double range_end;
+  int num_bins;
+  std::vector<int64_t> counts;
+  // Moments of every accumulated sample.
+  int64_t num_samples;
+  double mean;
+  double variance;
+  // Sampler diagnostics.
+  int64_t num_sweeps;
+  double acceptance_rate;
+};
+
+struct SharedPosteriorRegion;
+
+// Single writer of a POSIX shared-memory region holding the latest
+// PosteriorSummary. Publish() is a seqlock write: the sequence number is
+// odd while the payload is being copied, so readers never block the
+// sampler and simply retry a torn read. The region is created on
+// construction and unlinked on destruction.
+class SharedPosteriorPublisher {
+  public:
+  // name follows shm_open(), e.g. "/hopper_posterior". Summaries with more
+  // than max_bins bins are rebinned to fit: adjacent bins are merged in
+  // equal groups, any bins left over past the last whole group join the
+  // overflow count, and range_end moves to the end of the bins sent.
+  SharedPosteriorPublisher(const std::string& name, int max_bins);
+  ~SharedPosteriorPublisher();
+
+  bool IsOpen() const;
+  // Ignores summaries whose counts do not hold num_bins + 2 entries.
+  void Publish(const PosteriorSummary& summary);
+
+  private:
+  std::string name_;
+  int max_bins_;
+  size_t size_;
+  SharedPosteriorRegion* region_;
+};
+
+// Read-only view of a region created by a SharedPosteriorPublisher,
+// normally in another process. Depends on nothing but this library.
+class SharedPosteriorReader {
+  public:
+  explicit SharedPosteriorReader(const std::string& name);
+  ~SharedPosteriorReader();
+
+  bool IsOpen() const;
+  // Copies a consistent snapshot into summary. Returns false if nothing
+  // has been published yet or no consistent copy was obtained within
+  // max_attempts.
+  bool Read(PosteriorSummary* summary, int max_attempts = 100) const;
+  // Number of Publish() calls so far; cheap enough to poll for changes.
+  uint64_t GetVersion() const;
+
+  private:
+  size_t size_;
+  const SharedPosteriorRegion* region_;
+};
+
+}  // namespace sampler
+
+#endif  // SAMPLER_SHARED_POSTERIOR_H_
@@ -0,0 +1,155 @@
+#include <unistd.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "shared_posterior.h"
+#include "test_util.h"
+
+namespace {
+
+std::string RegionName(const std::string& test) {
+  return "/hopper_" + test + "_" + std::to_string(getpid());
+}
+
+// Every field is derived from k, so a reader can tell a torn copy apart.
+sampler::PosteriorSummary MakeSummary(int64_t k, int num_bins) {
+  sampler::PosteriorSummary summary;
+  summary.range_start = -1.0;
+  summary.range_end = 1.0;
+  summary.num_bins = num_bins;
+  summary.counts.assign(num_bins + 2, k);
+  summary.num_samples = k * (num_bins + 2);
+  summary.mean = k;
+  summary.variance = 2.0 * k;
+  summary.num_sweeps = k;
+  summary.acceptance_rate = 0.5;
+  return summary;
+}
+
+bool IsConsistent(const sampler::PosteriorSummary& summary) {
+  const int64_t k = summary.num_sweeps;
+  if (summary.counts.size() != summary.num_bins + 2 ||
+      summary.num_samples != k * (summary.num_bins + 2) ||
+      summary.mean != k || summary.variance != 2.0 * k) {
+    return false;
+  }
+  for (int64_t count : summary.counts) {
+    if (count != k) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void TestPublishAndRead() {
+  const std::string name = RegionName("publish");
+  sampler::SharedPosteriorPublisher publisher(name, 16);
+  EXPECT_TRUE(publisher.IsOpen());
+  sampler::SharedPosteriorReader reader(name);
+  EXPECT_TRUE(reader.IsOpen());
+
+  sampler::PosteriorSummary summary;
+  EXPECT_TRUE(reader.GetVersion() == 0);
+  EXPECT_TRUE(!reader.Read(&summary));
+
+  publisher.Publish(MakeSummary(3, 8));
+  EXPECT_TRUE(reader.GetVersion() == 1);
+  EXPECT_TRUE(reader.Read(&summary));
+  EXPECT_TRUE(IsConsistent(summary) && summary.num_sweeps == 3 && summary.num_bins == 8);
+  EXPECT_TRUE(summary.range_start == -1.0 && summary.range_end == 1.0);
+
+  publisher.Publish(MakeSummary(4, 16));
+  EXPECT_TRUE(reader.GetVersion() == 2);
+  EXPECT_TRUE(reader.Read(&summary));
+  EXPECT_TRUE(IsConsistent(summary) && summary.num_sweeps == 4 && summary.num_bins == 16);
+
+  // A summary whose counts do not match num_bins is dropped.
+  sampler::PosteriorSummary malformed = MakeSummary(5, 4);
+  malformed.counts.pop_back();
+  publisher.Publish(malformed);
+  EXPECT_TRUE(reader.GetVersion() == 2);
+}
+
+void TestRebin() {
+  const std::string name = RegionName("rebin");
+  sampler::SharedPosteriorPublisher publisher(name, 4);
+  sampler::SharedPosteriorReader reader(name);
+
+  // Ten bins of width 0.2 over [-1, 1) merge in groups of three; the tenth
+  // bin no longer fits and joins the overflow.
+  sampler::PosteriorSummary summary = MakeSummary(1, 10);
+  for (int i = 0; i < summary.counts.size(); ++i) {
+    summary.counts[i] = i;
+  }
+  publisher.Publish(summary);
+
+  sampler::PosteriorSummary published;
+  EXPECT_TRUE(reader.Read(&published));
+  EXPECT_TRUE(published.num_bins == 3);
+  EXPECT_NEAR(published.range_start, -1.0, 1e-12);
+  EXPECT_NEAR(published.range_end, 0.8, 1e-12);
+  EXPECT_TRUE(published.counts == std::vector<int64_t>({0, 1 + 2 + 3, 4 + 5 + 6, 7 + 8 + 9, 10 + 11}));
+  EXPECT_TRUE(published.num_samples == summary.num_samples);
+}
+
+void TestConcurrentReadsAreConsistent() {
+  const std::string name = RegionName("concurrent");
+  const int kNumReads = 20000;
+  sampler::SharedPosteriorPublisher publisher(name, 64);
+  sampler::SharedPosteriorReader reader(name);
+  publisher.Publish(MakeSummary(1, 1));
+
+  // The writer keeps publishing until the reader has taken all its copies.
+  std::atomic<bool> done(false);
+  int64_t num_publishes = 1;
+  std::thread writer([&publisher, &done, &num_publishes]() {
+    while (!done.load()) {
+      ++num_publishes;
+      publisher.Publish(MakeSummary(num_publishes, 1 + num_publishes % 64));
+    }
+  });
+
+  while (reader.GetVersion() < 2) {
+    std::this_thread::yield();
+  }
+  int num_torn = 0;
+  int num_failed = 0;
+  int64_t last = 0;
+  bool is_monotonic = true;
+  sampler::PosteriorSummary summary;
+  for (int i = 0; i < kNumReads; ++i) {
+    if (!reader.Read(&summary, 1000)) {
+      ++num_failed;
+      continue;
+    }
+    if (!IsConsistent(summary)) {
+      ++num_torn;
+    }
+    if (summary.num_sweeps < last) {
+      is_monotonic = false;
+    }
+    last = summary.num_sweeps;
+  }
+  done.store(true);
+  writer.join();
+
+  EXPECT_TRUE(num_torn == 0);
+  EXPECT_TRUE(num_failed < kNumReads / 100);
+  EXPECT_TRUE(is_monotonic);
+  EXPECT_TRUE(last > 1);
+  EXPECT_TRUE(reader.GetVersion() == num_publishes);
+  EXPECT_TRUE(reader.Read(&summary));
+  EXPECT_TRUE(IsConsistent(summary) && summary.num_sweeps == num_publishes);
+}
+
+}  // namespace
+
+int main() {
+  TestPublishAndRead();
+  TestRebin();
+  TestConcurrentReadsAreConsistent();
+  return sampler::testing::TestResult();
+}
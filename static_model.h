@@ -0,0 +1,404 @@
+#ifndef SAMPLER_STATIC_MODEL_H_
+#define SAMPLER_STATIC_MODEL_H_
+
+#include <array>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <tuple>
+#include <type_traits>
+
+#include "framework.h"
+
+// Compile-time model DSL. Node types, parent indices and fan-in are
+// template parameters, so a sweep compiles to straight-line code with no
+// virtual calls and no runtime-sized loops:
+//
+//   typedef sampler::StaticModel<
+//       sampler::StaticUniform,                   // 0: speed
+//       sampler::StaticGaussianEvidence<0>        // 1: next position
+//   > Model;
+//   Model model(sampler::StaticUniform(0.0, 10.0),
+//               sampler::StaticGaussianEvidence<0>({{10.0, 1.0}}, 4.0, 15.0));
+//   StaticMetroSampler<Model> sampler(model, proposal_stddev);
+//
+// A node refers to its parents by position in the model, and every parent
+// must come before its children.
+
+namespace sampler {
+
+// Compile-time list of parent positions.
+template <int... Idxs>
+struct IntPack;
+
+template <>
+struct IntPack<> {
+  static constexpr bool Contains(int) { return false; }
+  static constexpr bool AllLessThan(int) { return true; }
+};
+
+template <int First, int... Rest>
+struct IntPack<First, Rest...> {
+  static constexpr bool Contains(int idx) {
+    return idx == First || IntPack<Rest...>::Contains(idx);
+  }
+  static constexpr bool AllLessThan(int idx) {
+    return First < idx && IntPack<Rest...>::AllLessThan(idx);
+  }
+};
+
+// Linear Gaussian: mean beta[0] + sum_i beta[i + 1] * x_{ParentIdxs[i]},
+// same parameterization as GaussianNode.
+template <int... ParentIdxs>
+class StaticGaussian {
+  public:
+  typedef IntPack<ParentIdxs...> Parents;
+  static constexpr int kNumParents = sizeof...(ParentIdxs);
+  static constexpr bool kIsEvidence = false;
+
+  StaticGaussian(const std::array<double, kNumParents + 1>& beta, double sigma2) :
+    beta_(beta),
+    half_inv_sigma2_(0.5 / sigma2),
+    sigma_(sqrt(sigma2))
+  {}
+
+  double GetMean(const double* values) const {
+    // Leading 0.0 keeps the array non-empty for parentless nodes.
+    const double parent_values[] = {0.0, values[ParentIdxs]...};
+    double mean = beta_[0];
+    for (int i = 0; i < kNumParents; ++i) {
+      mean += beta_[i + 1] * parent_values[i + 1];
+    }
+    return mean;
+  }
+
+  template <int Self>
+  double GetLogConditional(const double* values) const {
+    const double residual = GetMean(values) - values[Self];
+    return -residual * residual * half_inv_sigma2_;
+  }
+
+  template <typename Generator>
+  double GetSample(const double* values, Generator* generator) const {
+    std::normal_distribution<double> normal(GetMean(values), sigma_);
+    return normal(*generator);
+  }
+
+  double GetEvidenceValue() const {
+    return 0.0;
+  }
+
+  private:
+  std::array<double, kNumParents + 1> beta_;
+  double half_inv_sigma2_;
+  double sigma_;
+};
+
+template <int... ParentIdxs>
+class StaticGaussianEvidence : public StaticGaussian<ParentIdxs...> {
+  public:
+  static constexpr bool kIsEvidence = true;
+
+  StaticGaussianEvidence(const std::array<double, sizeof...(ParentIdxs) + 1>& beta,
+                         double sigma2,
+                         double value) :
+    StaticGaussian<ParentIdxs...>(beta, sigma2),
+    value_(value)
+  {}
+
+  double GetEvidenceValue() const {
+    return value_;
+  }
+
+  private:
+  double value_;
+};
+
+// Flat prior on [from, to), matching UniformNode.
+class StaticUniform {
+  public:
+  typedef IntPack<> Parents;
+  static constexpr int kNumParents = 0;
+  static constexpr bool kIsEvidence = false;
+
+  StaticUniform(double from, double to) :
+    from_(from),
+    to_(to)
+  {}
+
+  template <int Self>
+  double GetLogConditional(const double*) const {
+    return 0.0;
+  }
+
+  template <typename Generator>
+  double GetSample(const double*, Generator* generator) const {
+    std::uniform_real_distribution<double> uniform(from_, to_);
+    return uniform(*generator);
+  }
+
+  double GetEvidenceValue() const {
+    return 0.0;
+  }
+
+  private:
+  double from_;
+  double to_;
+};
+
+template <typename... Nodes>
+class StaticModel {
+  public:
+  static constexpr int kNumNodes = sizeof...(Nodes);
+  typedef std::tuple<Nodes...> NodeTuple;
+
+  template <int I>
+  using NodeType = typename std::tuple_element<I, NodeTuple>::type;
+
+  explicit StaticModel(const Nodes&... nodes) :
+    nodes_(nodes...),
+    values_{{nodes.GetEvidenceValue()...}}
+  {
+    static_assert(ParentsPrecede<0>::value, "every parent must precede its children");
+  }
+
+  double* GetValues() {
+    return values_.data();
+  }
+
+  const double* GetValues() const {
+    return values_.data();
+  }
+
+  template <int I>
+  static constexpr bool IsEvidence() {
+    return NodeType<I>::kIsEvidence;
+  }
+
+  // Sum of the log conditionals that mention node I: its own and those of
+  // its children, with evidence terms scaled by inverse_temperature. Which
+  // terms exist is decided at compile time.
+  template <int I>
+  double GetBlanketLogDensity(double inverse_temperature) const {
+    return BlanketTerm<I>(std::integral_constant<int, 0>(), inverse_temperature);
+  }
+
+  // Draws every non-evidence node from its conditional, in model order.
+  template <typename Generator>
+  void SampleAncestral(Generator* generator) {
+    SampleFrom(std::integral_constant<int, 0>(), generator);
+  }
+
+  private:
+  template <int I, typename Unused = void>
+  struct ParentsPrecede {
+    static constexpr bool value =
+        NodeType<I>::Parents::AllLessThan(I) && ParentsPrecede<I + 1>::value;
+  };
+
+  template <typename Unused>
+  struct ParentsPrecede<kNumNodes, Unused> {
+    static constexpr bool value = true;
+  };
+
+  template <int I, int J>
+  double BlanketTerm(std::integral_constant<int, J>, double inverse_temperature) const {
+    const bool is_in_blanket = I == J || NodeType<J>::Parents::Contains(I);
+    double term = 0.0;
+    if (is_in_blanket) {
+      term = std::get<J>(nodes_).template GetLogConditional<J>(values_.data());
+      if (IsEvidence<J>()) {
+        term *= inverse_temperature;
+      }
+    }
+    return term + BlanketTerm<I>(std::integral_constant<int, J + 1>(), inverse_temperature);
+  }
+
+  template <int I>
+  double BlanketTerm(std::integral_constant<int, kNumNodes>, double) const {
+    return 0.0;
+  }
+
+  template <int I, typename Generator>
+  void SampleFrom(std::integral_constant<int, I>, Generator* generator) {
+    if (!IsEvidence<I>()) {
+      values_[I] = std::get<I>(nodes_).GetSample(values_.data(), generator);
+    }
+    SampleFrom(std::integral_constant<int, I + 1>(), generator);
+  }
+
+  template <typename Generator>
+  void SampleFrom(std::integral_constant<int, kNumNodes>, Generator*) {}
+
+  NodeTuple nodes_;
+  std::array<double, kNumNodes> values_;
+};
+
+// Stand-in registered with the Sampler for each static node, so that
+// Workers, Snapshot()/Restore() and BatchQueryRunner see ordinary Nodes. It holds
+// the value only; the density lives in the StaticModel.
+class StaticMirrorNode : public Node {
+  public:
+  explicit StaticMirrorNode(bool is_evidence) :
+    Node("static_mirror")
+  {
+    if (is_evidence) {
+      SetEvidence();
+    }
+  }
+
+  double GetConditional() const override {
+    return 1.0;
+  }
+
+  // Keeps the value StaticMetroSampler::Reset() already drew.
+  double GetSample() override {
+    return GetValue();
+  }
+};
+
+}  // namespace sampler
+
+// Metropolis sampler over a StaticModel, with a scalar Gaussian random
+// walk per node like MetroSampler with GaussianProposalDensity1D. The
+// sweep is expanded at compile time. Node i of the model is registration
+// index i, so Workers address nodes as with any other Sampler. Values are
+// copied to the registered mirror nodes after every sweep and read back
+// from them (evidence included) at the start of Infer().
+//
+// It is not a MetroSampler, so it cannot be a TemperedSampler replica:
+// replica exchange needs MetroSampler's per-node Prepare()/Sweep(), and a
+// ReplicaFactory must return MetroSamplers.
+template <typename Model>
+class StaticMetroSampler : public Sampler {
+  public:
+  // Each step adds N(0, proposal_stddev^2), the same step as
+  // GaussianProposalDensity1D(proposal_stddev).
+  StaticMetroSampler(const Model& model, double proposal_stddev) :
+    model_(model),
+    proposal_(0.0, proposal_stddev),
+    uniform_(0.0, 1.0),
+    num_proposals_(0),
+    num_accepted_proposals_(0)
+  {
+    RegisterMirrors(std::integral_constant<int, 0>());
+    PushValues();
+    SeedEngine(GetEngineSeed());
+  }
+
+  void Reset() override {
+    PullValues();
+    model_.SampleAncestral(&generator_);
+    PushValues();
+    num_proposals_ = 0;
+    num_accepted_proposals_ = 0;
+    Sampler::Reset();
+  }
+
+  void Infer(int num_iterations) override {
+    if (IsVerbose()) {
+      std::cerr << "StaticMetroSampler::Infer going for " << num_iterations << " iterations" << std::endl;
+    }
+    PullValues();
+    for (int i = 0; i < num_iterations; ++i) {
+      SweepFrom(std::integral_constant<int, 0>());
+      PushValues();
+      if (!EndSweep()) {
+        if (IsVerbose()) {
+          std::cerr << "StaticMetroSampler::Infer cancelled after " << i + 1 << " iterations" << std::endl;
+        }
+        break;
+      }
+    }
+    if (IsVerbose()) {
+      std::cerr << "StaticMetroSampler::Infer done" << std::endl;
+    }
+  }
+
+  double GetAcceptanceRate() const override {
+    return num_proposals_ > 0 ? double(num_accepted_proposals_) / num_proposals_ : 1.0;
+  }
+
+  protected:
+  void SeedEngine(uint64_t engine_seed) override {
+    generator_.seed(engine_seed);
+    proposal_.reset();
+    uniform_.reset();
+  }
+
+  void SaveEngineState(sampler::StateWriter* writer) const override {
+    sampler::WriteRandomState(generator_, writer);
+    sampler::WriteRandomState(proposal_, writer);
+    writer->WriteInt64(num_proposals_);
+    writer->WriteInt64(num_accepted_proposals_);
+  }
+
+  bool LoadEngineState(sampler::StateReader* reader) override {
+    return sampler::ReadRandomState(reader, &generator_) &&
+           sampler::ReadRandomState(reader, &proposal_) &&
+           reader->ReadInt64(&num_proposals_) &&
+           reader->ReadInt64(&num_accepted_proposals_);
+  }
+
+  private:
+  template <int I>
+  void RegisterMirrors(std::integral_constant<int, I>) {
+    Register(new sampler::StaticMirrorNode(Model::template IsEvidence<I>()));
+    RegisterMirrors(std::integral_constant<int, I + 1>());
+  }
+
+  void RegisterMirrors(std::integral_constant<int, Model::kNumNodes>) {}
+
+  template <int I>
+  void SweepFrom(std::integral_constant<int, I>) {
+    if (!Model::template IsEvidence<I>()) {
+      MetroStep<I>();
+    }
+    SweepFrom(std::integral_constant<int, I + 1>());
+  }
+
+  void SweepFrom(std::integral_constant<int, Model::kNumNodes>) {}
+
+  template <int I>
+  void MetroStep() {
+    double* values = model_.GetValues();
+    const double original = values[I];
+    const double inverse_temperature = GetInverseTemperature();
+    const double original_log_density =
+        model_.template GetBlanketLogDensity<I>(inverse_temperature);
+    values[I] = original + proposal_(generator_);
+    const double log_ratio =
+        model_.template GetBlanketLogDensity<I>(inverse_temperature) - original_log_density;
+    ++num_proposals_;
+    if (log_ratio >= 0.0 || log(uniform_(generator_)) < log_ratio) {
+      ++num_accepted_proposals_;
+    } else {
+      values[I] = original;
+    }
+  }
+
+  void PullValues() {
+    double* values = model_.GetValues();
+    for (int i = 0; i < Model::kNumNodes; ++i) {
+      if (GetNode(i)->IsInitialized() || GetNode(i)->IsEvidence()) {
+        values[i] = GetNode(i)->GetValue();
+      }
+    }
+  }
+
+  void PushValues() {
+    const double* values = model_.GetValues();
+    for (int i = 0; i < Model::kNumNodes; ++i) {
+      GetNode(i)->SetValue(values[i]);
+    }
+  }
+
+  Model model_;
+  std::default_random_engine generator_;
+  std::normal_distribution<double> proposal_;
+  std::uniform_real_distribution<double> uniform_;
+  int64_t num_proposals_;
+  int64_t num_accepted_proposals_;
+};
+
+#endif  // SAMPLER_STATIC_MODEL_H_
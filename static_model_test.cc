@@ -0,0 +1,174 @@
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "framework.h"
+#include "shared_posterior.h"
+#include "static_model.h"
+#include "test_util.h"
+
+namespace {
+
+// x ~ N(0, 1), y | x ~ N(2 + x / 2, 1 / 4), z | y ~ N(y - 1, 1 / 2), z = 2,
+// so x | z has mean 1 / 2 and variance 3 / 4 (see exact_gaussian_test).
+typedef sampler::StaticModel<
+    sampler::StaticGaussian<>,
+    sampler::StaticGaussian<0>,
+    sampler::StaticGaussianEvidence<1>
+> ChainModel;
+
+ChainModel MakeChainModel() {
+  return ChainModel(sampler::StaticGaussian<>({{0.0}}, 1.0),
+                    sampler::StaticGaussian<0>({{2.0, 0.5}}, 0.25),
+                    sampler::StaticGaussianEvidence<1>({{-1.0, 1.0}}, 0.5, 2.0));
+}
+
+MetroSampler* NewChainMetroSampler(double proposal_stddev) {
+  MetroSampler* sampler = new MetroSampler(new GaussianProposalDensity1D(proposal_stddev));
+  Node* x = new GaussianNode({0.0}, 1.0);
+  Node* y = new GaussianNode({2.0, 0.5}, 0.25);
+  Node* z = new GaussianEvidenceNode({-1.0, 1.0}, 0.5, 2.0);
+  y->EdgeFrom(x);
+  z->EdgeFrom(y);
+  sampler->Register(x);
+  sampler->Register(y);
+  sampler->Register(z);
+  return sampler;
+}
+
+// Four nodes with a uniform prior: speed u ~ U(0, 10) and positions
+// p_t | p_{t-1}, u ~ N(p_{t-1} + u, 1), starting at p_0 = 0 and observed at
+// p_3 = 15. Neither UniformNode nor StaticUniform bounds Metropolis moves,
+// so with p_3 ~ N(3 u, 3) given u, u | p_3 is N(5, 1 / 3) and p_1 | p_3 is
+// N(5, 2 / 3).
+typedef sampler::StaticModel<
+    sampler::StaticUniform,
+    sampler::StaticGaussian<0>,
+    sampler::StaticGaussian<1, 0>,
+    sampler::StaticGaussianEvidence<2, 0>
+> MotionModel;
+
+MotionModel MakeMotionModel() {
+  return MotionModel(sampler::StaticUniform(0.0, 10.0),
+                     sampler::StaticGaussian<0>({{0.0, 1.0}}, 1.0),
+                     sampler::StaticGaussian<1, 0>({{0.0, 1.0, 1.0}}, 1.0),
+                     sampler::StaticGaussianEvidence<2, 0>({{0.0, 1.0, 1.0}}, 1.0, 15.0));
+}
+
+MetroSampler* NewMotionMetroSampler(double proposal_stddev) {
+  MetroSampler* sampler = new MetroSampler(new GaussianProposalDensity1D(proposal_stddev));
+  Node* u = new UniformNode(0.0, 10.0);
+  Node* p1 = new GaussianNode({0.0, 1.0}, 1.0);
+  Node* p2 = new GaussianNode({0.0, 1.0, 1.0}, 1.0);
+  Node* p3 = new GaussianEvidenceNode({0.0, 1.0, 1.0}, 1.0, 15.0);
+  p1->EdgeFrom(u);
+  p2->EdgeFrom(p1);
+  p2->EdgeFrom(u);
+  p3->EdgeFrom(p2);
+  p3->EdgeFrom(u);
+  sampler->Register(u);
+  sampler->Register(p1);
+  sampler->Register(p2);
+  sampler->Register(p3);
+  return sampler;
+}
+
+void GetMoments(Sampler* sampler, int node_idx, int num_iterations,
+                sampler::PosteriorSummary* summary) {
+  sampler->SetVerbose(false);
+  sampler->Register(new HistogramWorker(-20.0, 20.0, 40, node_idx));
+  sampler->Reset();
+  sampler->Infer(1000);
+  sampler->GetWorker()->Reset();
+  sampler->Infer(num_iterations);
+  sampler->GetWorker()->GetSummary(summary);
+}
+
+// Both samplers take the same random walk step for the same argument, so
+// their acceptance rates agree as well as their moments.
+template <typename Model>
+void TestMatchesMetroSampler(const Model& model, MetroSampler* metro, int node_idx,
+                             double proposal_stddev, double mean, double variance) {
+  const int kNumIterations = 200000;
+  StaticMetroSampler<Model> fast(model, proposal_stddev);
+  std::unique_ptr<MetroSampler> reference(metro);
+  sampler::PosteriorSummary fast_summary;
+  sampler::PosteriorSummary reference_summary;
+  GetMoments(&fast, node_idx, kNumIterations, &fast_summary);
+  GetMoments(reference.get(), node_idx, kNumIterations, &reference_summary);
+
+  EXPECT_NEAR(fast_summary.mean, mean, 0.05 * sqrt(variance));
+  EXPECT_NEAR(fast_summary.variance, variance, 0.05 * variance);
+  EXPECT_NEAR(reference_summary.mean, mean, 0.05 * sqrt(variance));
+  EXPECT_NEAR(reference_summary.variance, variance, 0.05 * variance);
+  EXPECT_NEAR(fast.GetAcceptanceRate(), reference->GetAcceptanceRate(), 0.02);
+}
+
+void TestEvidenceFromMirrors() {
+  StaticMetroSampler<ChainModel> sampler(MakeChainModel(), 0.5);
+  sampler.SetVerbose(false);
+  EXPECT_TRUE(sampler.GetNumNodes() == 3);
+  EXPECT_TRUE(sampler.GetNode(2)->IsEvidence());
+  EXPECT_TRUE(sampler.GetNode(2)->GetValue() == 2.0);
+
+  // New evidence is read back from the mirror node, as BatchQueryRunner
+  // sets it: with z = 4, x | z has mean 3 / 2.
+  sampler.GetNode(2)->SetValue(4.0);
+  sampler::PosteriorSummary summary;
+  GetMoments(&sampler, 0, 100000, &summary);
+  EXPECT_NEAR(summary.mean, 1.5, 0.05);
+}
+
+void TestRestoreContinuesIdentically() {
+  StaticMetroSampler<MotionModel> original(MakeMotionModel(), 1.0);
+  original.SetVerbose(false);
+  original.Register(new HistogramWorker(0.0, 10.0, 20, 0));
+  original.Reset();
+  original.Infer(100);
+  const std::string snapshot = original.Snapshot();
+  original.Infer(100);
+
+  StaticMetroSampler<MotionModel> restored(MakeMotionModel(), 1.0);
+  restored.SetVerbose(false);
+  restored.Register(new HistogramWorker(0.0, 10.0, 20, 0));
+  EXPECT_TRUE(restored.Restore(snapshot));
+  restored.Infer(100);
+  EXPECT_TRUE(restored.Snapshot() == original.Snapshot());
+}
+
+// Reports time per sweep against the equivalent MetroSampler. Timing is
+// only printed, not checked, since it depends on the machine and load.
+void BenchmarkSweeps() {
+  const int kNumIterations = 200000;
+  StaticMetroSampler<MotionModel> fast(MakeMotionModel(), 1.0);
+  std::unique_ptr<MetroSampler> reference(NewMotionMetroSampler(1.0));
+  Sampler* samplers[] = {&fast, reference.get()};
+  double nanoseconds_per_sweep[2];
+  for (int i = 0; i < 2; ++i) {
+    samplers[i]->SetVerbose(false);
+    samplers[i]->Register(new HistogramWorker(0.0, 10.0, 20, 0));
+    samplers[i]->Reset();
+    const auto start = std::chrono::steady_clock::now();
+    samplers[i]->Infer(kNumIterations);
+    const std::chrono::duration<double, std::nano> elapsed =
+        std::chrono::steady_clock::now() - start;
+    nanoseconds_per_sweep[i] = elapsed.count() / kNumIterations;
+  }
+  std::cerr << "static_model_test 4-node sweep: StaticMetroSampler "
+            << nanoseconds_per_sweep[0] << " ns, MetroSampler "
+            << nanoseconds_per_sweep[1] << " ns, speedup "
+            << nanoseconds_per_sweep[1] / nanoseconds_per_sweep[0] << "x" << std::endl;
+}
+
+}  // namespace
+
+int main() {
+  TestMatchesMetroSampler(MakeChainModel(), NewChainMetroSampler(2.0), 0, 2.0, 0.5, 0.75);
+  TestMatchesMetroSampler(MakeMotionModel(), NewMotionMetroSampler(1.0), 0, 1.0, 5.0, 1.0 / 3.0);
+  TestMatchesMetroSampler(MakeMotionModel(), NewMotionMetroSampler(1.0), 1, 1.0, 5.0, 2.0 / 3.0);
+  TestEvidenceFromMirrors();
+  TestRestoreContinuesIdentically();
+  BenchmarkSweeps();
+  return sampler::testing::TestResult();
+}
@@ -0,0 +1,293 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include "tempered.h"
+
+// Swap rounds between ladder updates during adaptation.
+static const int kLadderAdaptationInterval = 10;
+// Initial step, in log temperature gap per unit of swap rate difference.
+static const double kLadderAdaptationRate = 1.0;
+
+TemperedSampler::TemperedSampler(const ReplicaFactory& factory,
+                                 int num_replicas,
+                                 double max_temperature) :
+  swap_interval_(10),
+  num_adaptation_rounds_(0),
+  num_adapted_rounds_(0),
+  num_rounds_(0),
+  num_swaps_proposed_(num_replicas > 1 ? num_replicas - 1 : 0, 0),
+  num_swaps_accepted_(num_swaps_proposed_.size(), 0),
+  window_swaps_proposed_(num_swaps_proposed_.size(), 0),
+  window_swaps_accepted_(num_swaps_proposed_.size(), 0)
+{
+  if (num_replicas < 1) {
+    num_replicas = 1;
+  }
+  for (int k = 0; k < num_replicas; ++k) {
+    replicas_.emplace_back(factory());
+    const double fraction = num_replicas > 1 ? double(k) / (num_replicas - 1) : 0.0;
+    temperatures_.push_back(pow(max_temperature, fraction));
+  }
+  ApplyTemperatures();
+  SeedEngine(GetEngineSeed());
+}
+
+void TemperedSampler::SeedEngine(uint64_t engine_seed) {
+  // Stream 0 drives the swap decisions, stream k + 1 replica k.
+  uniform_source_.Seed(sampler::DeriveSeed(engine_seed, 0));
+  for (int k = 0; k < replicas_.size(); ++k) {
+    replicas_[k]->SetSeed(sampler::DeriveSeed(engine_seed, k + 1));
+  }
+}
+
+void TemperedSampler::CopyEvidenceToReplicas() {
+  MetroSampler* cold_replica = GetColdReplica();
+  for (int i = 0; i < cold_replica->GetNumNodes(); ++i) {
+    const Node* node = cold_replica->GetNode(i);
+    if (!node->IsEvidence()) {
+      continue;
+    }
+    for (int k = 1; k < replicas_.size(); ++k) {
+      replicas_[k]->GetNode(i)->SetValue(node->GetValue());
+    }
+  }
+}
+
+void TemperedSampler::ApplyTemperatures() {
+  for (int k = 0; k < replicas_.size(); ++k) {
+    replicas_[k]->SetInverseTemperature(1.0 / temperatures_[k]);
+  }
+}
+
+Node* TemperedSampler::GetNode(int registration_idx) {
+  return GetColdReplica()->GetNode(registration_idx);
+}
+
+int TemperedSampler::GetNumNodes() const {
+  return replicas_[0]->GetNumNodes();
+}
+
+double TemperedSampler::GetAcceptanceRate() const {
+  return replicas_[0]->GetAcceptanceRate();
+}
+
+MetroSampler* TemperedSampler::GetColdReplica() {
+  return replicas_[0].get();
+}
+
+void TemperedSampler::SetSwapInterval(int num_sweeps) {
+  swap_interval_ = num_sweeps > 0 ? num_sweeps : 1;
+}
+
+void TemperedSampler::SetLadderAdaptationRounds(int num_rounds) {
+  num_adaptation_rounds_ = num_rounds;
+}
+
+const std::vector<double>& TemperedSampler::GetTemperatures() const {
+  return temperatures_;
+}
+
+std::vector<double> TemperedSampler::GetSwapAcceptanceRates() const {
+  std::vector<double> rates;
+  for (int k = 0; k < num_swaps_proposed_.size(); ++k) {
+    rates.push_back(num_swaps_proposed_[k] > 0 ?
+        double(num_swaps_accepted_[k]) / num_swaps_proposed_[k] : 0.0);
+  }
+  return rates;
+}
+
+void TemperedSampler::Reset() {
+  CopyEvidenceToReplicas();
+  for (const auto& replica : replicas_) {
+    replica->Reset();
+  }
+  for (int k = 0; k < num_swaps_proposed_.size(); ++k) {
+    num_swaps_proposed_[k] = 0;
+    num_swaps_accepted_[k] = 0;
+  }
+  Sampler::Reset();
+}
+
+void TemperedSampler::Infer(int num_iterations) {
+  if (IsVerbose()) {
+    std::cerr << "TemperedSampler::Infer going for " << num_iterations << " iterations on "
+              << replicas_.size() << " replicas" << std::endl;
+  }
+  CopyEvidenceToReplicas();
+  for (const auto& replica : replicas_) {
+    if (!replica->Prepare()) {
+      std::cerr << "TemperedSampler::Infer model is invalid" << std::endl;
+      return;
+    }
+  }
+  for (int i = 0; i < num_iterations; i += swap_interval_) {
+    const int num_sweeps = std::min(swap_interval_, num_iterations - i);
+    SweepReplicas(num_sweeps);
+    SwapReplicas();
+    if (num_adapted_rounds_ < num_adaptation_rounds_) {
+      ++num_adapted_rounds_;
+      if (num_adapted_rounds_ % kLadderAdaptationInterval == 0) {
+        AdaptLadder();
+      }
+    }
+    if (!CompleteSweeps(num_sweeps)) {
+      if (IsVerbose()) {
+        std::cerr << "TemperedSampler::Infer cancelled after " << i + num_sweeps << " iterations" << std::endl;
+      }
+      break;
+    }
+  }
+  if (IsVerbose()) {
+    std::cerr << "TemperedSampler::Infer done" << std::endl;
+  }
+}
+
+void TemperedSampler::SweepReplicas(int num_sweeps) {
+  // Replicas share no state, so the only synchronization is the join at
+  // the end of the round. The cold replica runs on the calling thread and
+  // feeds the Worker after each of its sweeps.
+  sampler::Scheduler* scheduler = GetScheduler();
+  sampler::TaskGroup hot_replicas;
+  for (int k = 1; k < replicas_.size(); ++k) {
+    MetroSampler* replica = replicas_[k].get();
+    scheduler->Submit([replica, num_sweeps]() {
+      for (int i = 0; i < num_sweeps; ++i) {
+        replica->Sweep();
+      }
+    }, &hot_replicas);
+  }
+  MetroSampler* cold_replica = GetColdReplica();
+  for (int i = 0; i < num_sweeps; ++i) {
+    cold_replica->Sweep();
+    GetWorker()->Sample(this);
+  }
+  scheduler->Wait(&hot_replicas);
+}
+
+void TemperedSampler::SwapReplicas() {
+  // Alternate between even and odd neighbour pairs so that every pair in a
+  // round is disjoint.
+  const int first = num_rounds_++ % 2;
+  for (int k = first; k + 1 < replicas_.size(); k += 2) {
+    MetroSampler* colder = replicas_[k].get();
+    MetroSampler* hotter = replicas_[k + 1].get();
+    const double log_ratio =
+        (colder->GetInverseTemperature() - hotter->GetInverseTemperature()) *
+        (GetLogLikelihood(hotter) - GetLogLikelihood(colder));
+    ++num_swaps_proposed_[k];
+    ++window_swaps_proposed_[k];
+    if (log_ratio >= 0.0 || log(uniform_source_.Draw()) < log_ratio) {
+      SwapStates(colder, hotter);
+      ++num_swaps_accepted_[k];
+      ++window_swaps_accepted_[k];
+    }
+  }
+}
+
+void TemperedSampler::SwapStates(MetroSampler* a, MetroSampler* b) {
+  for (int i = 0; i < a->GetNumNodes(); ++i) {
+    Node* node_a = a->GetNode(i);
+    if (node_a->IsEvidence()) {
+      continue;
+    }
+    Node* node_b = b->GetNode(i);
+    const double value_a = node_a->GetValue();
+    node_a->SetValue(node_b->GetValue());
+    node_b->SetValue(value_a);
+  }
+}
+
+double TemperedSampler::GetLogLikelihood(MetroSampler* replica) const {
+  double log_likelihood = 0.0;
+  for (int i = 0; i < replica->GetNumNodes(); ++i) {
+    Node* node = replica->GetNode(i);
+    if (node->IsEvidence()) {
+      log_likelihood += node->GetLogConditional();
+    }
+  }
+  return log_likelihood;
+}
+
+void TemperedSampler::AdaptLadder() {
+  const int num_gaps = temperatures_.size() - 1;
+  if (num_gaps < 2) {
+    return;
+  }
+  std::vector<double> rates(num_gaps);
+  double mean_rate = 0.0;
+  for (int k = 0; k < num_gaps; ++k) {
+    rates[k] = window_swaps_proposed_[k] > 0 ?
+        double(window_swaps_accepted_[k]) / window_swaps_proposed_[k] : 0.0;
+    mean_rate += rates[k] / num_gaps;
+    window_swaps_proposed_[k] = 0;
+    window_swaps_accepted_[k] = 0;
+  }
+
+  // Widen gaps that swap more often than average and shrink the others,
+  // with a step that decays so the ladder settles, then rescale the gaps
+  // to keep both ends of the ladder fixed.
+  const double step = kLadderAdaptationRate /
+      sqrt(1.0 + num_adapted_rounds_ / kLadderAdaptationInterval);
+  std::vector<double> gaps(num_gaps);
+  double total_gap = 0.0;
+  for (int k = 0; k < num_gaps; ++k) {
+    gaps[k] = (temperatures_[k + 1] - temperatures_[k]) * exp(step * (rates[k] - mean_rate));
+    total_gap += gaps[k];
+  }
+  const double scale = (temperatures_.back() - temperatures_.front()) / total_gap;
+  for (int k = 0; k < num_gaps - 1; ++k) {
+    temperatures_[k + 1] = temperatures_[k] + gaps[k] * scale;
+  }
+  ApplyTemperatures();
+}
+
+void TemperedSampler::SaveEngineState(sampler::StateWriter* writer) const {
+  writer->WriteInt64(replicas_.size());
+  for (const auto& replica : replicas_) {
+    writer->WriteString(replica->Snapshot());
+  }
+  writer->WriteDoubles(temperatures_);
+  writer->WriteInt64(num_adapted_rounds_);
+  writer->WriteInt64(num_rounds_);
+  for (int k = 0; k < num_swaps_proposed_.size(); ++k) {
+    writer->WriteInt64(num_swaps_proposed_[k]);
+    writer->WriteInt64(num_swaps_accepted_[k]);
+    writer->WriteInt64(window_swaps_proposed_[k]);
+    writer->WriteInt64(window_swaps_accepted_[k]);
+  }
+  uniform_source_.SaveState(writer);
+}
+
+bool TemperedSampler::LoadEngineState(sampler::StateReader* reader) {
+  int64_t num_replicas = 0;
+  if (!reader->ReadInt64(&num_replicas) || num_replicas != replicas_.size()) {
+    return false;
+  }
+  for (const auto& replica : replicas_) {
+    std::string snapshot;
+    if (!reader->ReadString(&snapshot) || !replica->Restore(snapshot)) {
+      return false;
+    }
+  }
+  std::vector<double> temperatures;
+  int64_t num_adapted_rounds = 0;
+  int64_t num_rounds = 0;
+  if (!reader->ReadDoubles(&temperatures) || temperatures.size() != temperatures_.size() ||
+      !reader->ReadInt64(&num_adapted_rounds) || !reader->ReadInt64(&num_rounds)) {
+    return false;
+  }
+  for (int k = 0; k < num_swaps_proposed_.size(); ++k) {
+    if (!reader->ReadInt64(&num_swaps_proposed_[k]) ||
+        !reader->ReadInt64(&num_swaps_accepted_[k]) ||
+        !reader->ReadInt64(&window_swaps_proposed_[k]) ||
+        !reader->ReadInt64(&window_swaps_accepted_[k])) {
+      return false;
+    }
+  }
+  temperatures_.swap(temperatures);
+  num_adapted_rounds_ = num_adapted_rounds;
+  num_rounds_ = num_rounds;
+  ApplyTemperatures();
+  return uniform_source_.LoadState(reader);
+}
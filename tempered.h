@@ -0,0 +1,76 @@
+#ifndef SAMPLER_TEMPERED_H_
+#define SAMPLER_TEMPERED_H_
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "framework.h"
+
+// Parallel tempering (replica exchange). Runs num_replicas copies of one
+// model, replica k targeting prior * likelihood^(1 / T_k) with
+// 1 = T_0 < ... < T_{K-1} = max_temperature. Replicas sweep concurrently on
+// the Scheduler; every swap interval, neighbouring replicas propose to
+// exchange states, so hot replicas carry the cold one across modes. Only
+// the cold replica (T = 1) feeds the Worker, and GetNode() resolves to it;
+// evidence values set through GetNode() are copied to every replica by
+// Reset() and Infer(). Each replica draws from its own seed, derived from
+// this Sampler's (see SetSeed()).
+class TemperedSampler : public Sampler {
+  public:
+  // Builds one replica, including its nodes, edges and blocks. It must
+  // build the same graph on every call. Replicas' own Workers are unused.
+  typedef std::function<MetroSampler*()> ReplicaFactory;
+
+  // Temperatures start geometrically spaced.
+  TemperedSampler(const ReplicaFactory& factory, int num_replicas, double max_temperature);
+
+  void Reset() override;
+  void Infer(int num_iterations) override;
+  Node* GetNode(int registration_idx) override;
+  int GetNumNodes() const override;
+  // Of the cold replica.
+  double GetAcceptanceRate() const override;
+
+  // Sweeps every replica does between swap attempts. Defaults to 10.
+  void SetSwapInterval(int num_sweeps);
+  // Over the first num_rounds swap rounds, counted across Infer() calls,
+  // the interior temperatures move to equalize neighbour swap rates while
+  // T_0 and T_{K-1} stay fixed. Treat those samples as burn-in.
+  void SetLadderAdaptationRounds(int num_rounds);
+
+  const std::vector<double>& GetTemperatures() const;
+  // Fraction of accepted swaps between replicas k and k + 1, since Reset().
+  std::vector<double> GetSwapAcceptanceRates() const;
+  MetroSampler* GetColdReplica();
+
+  protected:
+  void SeedEngine(uint64_t engine_seed) override;
+  void SaveEngineState(sampler::StateWriter* writer) const override;
+  bool LoadEngineState(sampler::StateReader* reader) override;
+
+  private:
+  void CopyEvidenceToReplicas();
+  void SweepReplicas(int num_sweeps);
+  void SwapReplicas();
+  void SwapStates(MetroSampler* a, MetroSampler* b);
+  double GetLogLikelihood(MetroSampler* replica) const;
+  void AdaptLadder();
+  void ApplyTemperatures();
+
+  std::vector<std::unique_ptr<MetroSampler>> replicas_;
+  std::vector<double> temperatures_;
+  int swap_interval_;
+  int num_adaptation_rounds_;
+  int num_adapted_rounds_;
+  int num_rounds_;
+  // Per neighbour pair: totals since Reset() and the current adaptation
+  // window.
+  std::vector<int64_t> num_swaps_proposed_;
+  std::vector<int64_t> num_swaps_accepted_;
+  std::vector<int64_t> window_swaps_proposed_;
+  std::vector<int64_t> window_swaps_accepted_;
+  UniformSource uniform_source_;
+};
+
+#endif  // SAMPLER_TEMPERED_H_
@@ -0,0 +1,224 @@
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "batch_query.h"
+#include "framework.h"
+#include "scheduler.h"
+#include "tempered.h"
+#include "test_util.h"
+
+namespace {
+
+// Summarizes node 0 by the fraction of samples above zero and the mean.
+class SignWorker : public Worker {
+  public:
+  SignWorker() : num_positive_(0), sum_(0.0), num_samples_(0) {}
+  void Reset() override {
+    num_positive_ = 0;
+    sum_ = 0.0;
+    num_samples_ = 0;
+  }
+  void Sample(Sampler* sampler) override {
+    const double value = sampler->GetNode(0)->GetValue();
+    num_positive_ += value > 0.0;
+    sum_ += value;
+    ++num_samples_;
+  }
+  std::string ToJsonString() const override {
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "{\"mean\":%.17g}", GetMean());
+    return buffer;
+  }
+  double GetPositiveFraction() const { return double(num_positive_) / num_samples_; }
+  double GetMean() const { return sum_ / num_samples_; }
+
+  private:
+  int64_t num_positive_;
+  double sum_;
+  int64_t num_samples_;
+};
+
+double ParseMean(const std::string& summary) {
+  const size_t colon = summary.find(':');
+  return colon == std::string::npos ? 0.0 : strtod(summary.c_str() + colon + 1, nullptr);
+}
+
+// x ~ N(0, 25), m ~ {0.3, 0.7} and observed y | m, x ~ N(+-x, 0.1) = 5:
+// the posterior of x has modes near +5 (m = 0) and -5 (m = 1) with weights
+// 0.3 and 0.7, and a chain must change m and x together to cross.
+const double kPositiveModeWeight = 0.3;
+
+MetroSampler* NewBimodalReplica() {
+  MetroSampler* sampler = new MetroSampler(new GaussianProposalDensity1D(0.5));
+  sampler->SetVerbose(false);
+  Node* x = new GaussianNode({0.0}, 25.0, "x");
+  Node* m = new DiscreteNode(2, {kPositiveModeWeight, 1.0 - kPositiveModeWeight}, "m");
+  Node* y = new ConditionalGaussianNode({{0.0, 1.0}, {0.0, -1.0}}, {0.1, 0.1}, "y");
+  y->EdgeFrom(m);
+  y->EdgeFrom(x);
+  y->SetValue(5.0);
+  y->SetEvidence();
+  sampler->Register(x);
+  sampler->Register(m);
+  sampler->Register(y);
+  return sampler;
+}
+
+TemperedSampler* NewBimodalSampler(int num_replicas) {
+  TemperedSampler* sampler = new TemperedSampler(NewBimodalReplica, num_replicas, 1000.0);
+  sampler->SetVerbose(false);
+  sampler->Register(new SignWorker);
+  return sampler;
+}
+
+void TestBimodalModeWeights() {
+  std::unique_ptr<TemperedSampler> tempered(NewBimodalSampler(12));
+  tempered->Reset();
+  tempered->Infer(100000);
+  const SignWorker* worker = static_cast<const SignWorker*>(tempered->GetWorker());
+  EXPECT_NEAR(worker->GetPositiveFraction(), kPositiveModeWeight, 0.05);
+
+  // Without tempering, the chain stays in the mode it starts in.
+  std::unique_ptr<MetroSampler> plain(NewBimodalReplica());
+  plain->Register(new SignWorker);
+  plain->Reset();
+  plain->Infer(40000);
+  const double plain_fraction =
+      static_cast<const SignWorker*>(plain->GetWorker())->GetPositiveFraction();
+  EXPECT_TRUE(plain_fraction < 0.01 || plain_fraction > 0.99);
+}
+
+void TestSwapAcceptanceRates() {
+  std::unique_ptr<TemperedSampler> sampler(NewBimodalSampler(5));
+  sampler->Reset();
+  std::vector<double> rates = sampler->GetSwapAcceptanceRates();
+  EXPECT_TRUE(rates.size() == 4);
+  for (double rate : rates) {
+    EXPECT_TRUE(rate == 0.0);
+  }
+  sampler->Infer(4000);
+  rates = sampler->GetSwapAcceptanceRates();
+  EXPECT_TRUE(rates.size() == 4);
+  for (double rate : rates) {
+    EXPECT_TRUE(rate > 0.0 && rate <= 1.0);
+  }
+}
+
+void TestLadderAdaptationKeepsEnds() {
+  std::unique_ptr<TemperedSampler> sampler(NewBimodalSampler(6));
+  const std::vector<double> initial = sampler->GetTemperatures();
+  sampler->SetLadderAdaptationRounds(500);
+  sampler->Reset();
+  sampler->Infer(10000);
+  const std::vector<double>& adapted = sampler->GetTemperatures();
+  EXPECT_TRUE(adapted.size() == initial.size());
+  EXPECT_TRUE(adapted.front() == 1.0);
+  EXPECT_TRUE(adapted.back() == 1000.0);
+  bool has_moved = false;
+  for (int k = 0; k + 1 < adapted.size(); ++k) {
+    EXPECT_TRUE(adapted[k] < adapted[k + 1]);
+    has_moved = has_moved || adapted[k] != initial[k];
+  }
+  EXPECT_TRUE(has_moved);
+}
+
+// A Sampler restored mid-run, ladder adaptation included, continues exactly
+// as the original does.
+void TestSnapshotRestore() {
+  std::unique_ptr<TemperedSampler> original(NewBimodalSampler(4));
+  original->SetLadderAdaptationRounds(100);
+  original->Reset();
+  original->Infer(500);
+  const std::string snapshot = original->Snapshot();
+  original->Infer(1500);
+
+  std::unique_ptr<TemperedSampler> restored(NewBimodalSampler(4));
+  restored->SetLadderAdaptationRounds(100);
+  EXPECT_TRUE(restored->Restore(snapshot));
+  restored->Infer(1500);
+  EXPECT_TRUE(restored->GetTemperatures() == original->GetTemperatures());
+  EXPECT_TRUE(restored->GetSwapAcceptanceRates() == original->GetSwapAcceptanceRates());
+  for (int i = 0; i < original->GetNumNodes(); ++i) {
+    EXPECT_TRUE(restored->GetNode(i)->GetValue() == original->GetNode(i)->GetValue());
+  }
+  EXPECT_TRUE(restored->Snapshot() == original->Snapshot());
+
+  // A snapshot of a different ladder size is rejected.
+  std::unique_ptr<TemperedSampler> mismatched(NewBimodalSampler(3));
+  EXPECT_TRUE(!mismatched->Restore(snapshot));
+}
+
+// x ~ N(0, 4) and observed y | x ~ N(x, 1), so E[x | y] = 4 y / 5.
+MetroSampler* NewLinearReplica() {
+  MetroSampler* sampler = new MetroSampler(new GaussianProposalDensity1D(1.5));
+  sampler->SetVerbose(false);
+  Node* x = new GaussianNode({0.0}, 4.0, "x");
+  Node* y = new GaussianEvidenceNode({0.0, 1.0}, 1.0, 0.0, "y");
+  y->EdgeFrom(x);
+  sampler->Register(x);
+  sampler->Register(y);
+  return sampler;
+}
+
+Sampler* NewTemperedModel() {
+  TemperedSampler* sampler = new TemperedSampler(NewLinearReplica, 3, 10.0);
+  sampler->SetVerbose(false);
+  sampler->Register(new SignWorker);
+  return sampler;
+}
+
+// Query evidence is set through the cold replica and must reach every
+// replica, or the hot ones would swap in states of the wrong posterior.
+void TestBatchEvidenceReachesReplicas() {
+  sampler::SchedulerOptions options;
+  options.num_workers = 2;
+  sampler::Scheduler scheduler(options);
+  sampler::BatchQueryRunner runner(NewTemperedModel, &scheduler);
+  const std::vector<sampler::EvidenceAssignment> queries = {{{1, 10.0}}, {{1, -5.0}}};
+  std::vector<std::string> summaries;
+  runner.Run(queries, 20000, &summaries);
+  EXPECT_TRUE(summaries.size() == 2);
+  if (summaries.size() == 2) {
+    EXPECT_NEAR(ParseMean(summaries[0]), 8.0, 0.25);
+    EXPECT_NEAR(ParseMean(summaries[1]), -4.0, 0.25);
+  }
+}
+
+// x ~ N(0, 1) with 30 observations y_i | x ~ N(x, 0.01) = 50. At the prior
+// draw of x every observation's density underflows to 0, so the scalar
+// step must compare log densities to leave it.
+void TestScalarStepLeavesUnderflow() {
+  const int kNumObservations = 30;
+  for (double inverse_temperature : {1.0, 0.1}) {
+    MetroSampler sampler(new GaussianProposalDensity1D(0.5));
+    sampler.SetVerbose(false);
+    Node* x = new GaussianNode({0.0}, 1.0, "x");
+    sampler.Register(x);
+    for (int i = 0; i < kNumObservations; ++i) {
+      Node* y = new GaussianEvidenceNode({0.0, 1.0}, 0.01, 50.0, "y");
+      y->EdgeFrom(x);
+      sampler.Register(y);
+    }
+    sampler.Register(new SignWorker);
+    sampler.SetInverseTemperature(inverse_temperature);
+    sampler.Reset();
+    sampler.Infer(2000);
+    const double precision = kNumObservations * inverse_temperature / 0.01;
+    EXPECT_NEAR(x->GetValue(), precision * 50.0 / (1.0 + precision), 0.2);
+  }
+}
+
+}  // namespace
+
+int main() {
+  TestBimodalModeWeights();
+  TestSwapAcceptanceRates();
+  TestLadderAdaptationKeepsEnds();
+  TestSnapshotRestore();
+  TestBatchEvidenceReachesReplicas();
+  TestScalarStepLeavesUnderflow();
+  return sampler::testing::TestResult();
+}
@@ -0,0 +1,52 @@
+#ifndef SAMPLER_TEST_UTIL_H_
+#define SAMPLER_TEST_UTIL_H_
+
+#include <cmath>
+#include <iostream>
+
+// Minimal checks for the *_test.cc binaries: each failed check is printed
+// with its location, and main() returns TestResult() so that a failure
+// fails the test target.
+
+namespace sampler {
+namespace testing {
+
+inline int& NumFailures() {
+  static int num_failures = 0;
+  return num_failures;
+}
+
+inline void Expect(bool condition, const char* expression, const char* file, int line) {
+  if (!condition) {
+    std::cerr << file << ":" << line << ": expected " << expression << std::endl;
+    ++NumFailures();
+  }
+}
+
+inline void ExpectNear(double actual, double expected, double tolerance,
+                       const char* expression, const char* file, int line) {
+  if (!(fabs(actual - expected) <= tolerance)) {
+    std::cerr << file << ":" << line << ": " << expression << " is " << actual
+              << ", expected " << expected << " +- " << tolerance << std::endl;
+    ++NumFailures();
+  }
+}
+
+inline int TestResult() {
+  if (NumFailures() > 0) {
+    std::cerr << NumFailures() << " check(s) failed" << std::endl;
+    return 1;
+  }
+  std::cerr << "PASSED" << std::endl;
+  return 0;
+}
+
+}  // namespace testing
+}  // namespace sampler
+
+#define EXPECT_TRUE(condition) \
+  sampler::testing::Expect((condition), #condition, __FILE__, __LINE__)
+#define EXPECT_NEAR(actual, expected, tolerance) \
+  sampler::testing::ExpectNear((actual), (expected), (tolerance), #actual, __FILE__, __LINE__)
+
+#endif  // SAMPLER_TEST_UTIL_H_
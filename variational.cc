@@ -0,0 +1,377 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include "variational.h"
+
+// Gradient steps per ELBO window used for convergence detection.
+static const int kElboWindow = 100;
+// Gradient budget Infer() uses when Fit() was never called.
+static const int kDefaultMaxFitIterations = 10000;
+// Adam decay rates and denominator guard.
+static const double kAdamBeta1 = 0.9;
+static const double kAdamBeta2 = 0.999;
+static const double kAdamEpsilon = 1e-8;
+// Relative step of the central differences.
+static const double kDifferenceStep = 1e-5;
+// Bounded nodes start at least this fraction of their width inside it.
+static const double kMinBoundedFraction = 1e-6;
+
+VariationalEngine::VariationalEngine() :
+  learning_rate_(0.05),
+  num_monte_carlo_samples_(1),
+  tolerance_(1e-3),
+  num_steps_(0),
+  elbo_(0.0),
+  is_fitted_(false),
+  standard_normal_(1.0)
+{
+  SeedEngine(GetEngineSeed());
+}
+
+void VariationalEngine::SetLearningRate(double learning_rate) {
+  learning_rate_ = learning_rate;
+}
+
+void VariationalEngine::SetNumMonteCarloSamples(int num_samples) {
+  num_monte_carlo_samples_ = num_samples > 0 ? num_samples : 1;
+}
+
+void VariationalEngine::SetTolerance(double tolerance) {
+  tolerance_ = tolerance;
+}
+
+const std::vector<double>& VariationalEngine::GetMeans() const {
+  return means_;
+}
+
+std::vector<double> VariationalEngine::GetStandardDeviations() const {
+  std::vector<double> sigmas;
+  for (double log_sigma : log_sigmas_) {
+    sigmas.push_back(exp(log_sigma));
+  }
+  return sigmas;
+}
+
+double VariationalEngine::GetElbo() const {
+  return elbo_;
+}
+
+bool VariationalEngine::FindLatentNodes() {
+  // Evidence may have changed since the nodes were found.
+  if (!HasValidDiscreteNodes()) {
+    return false;
+  }
+  if (!latent_nodes_.empty()) {
+    return true;
+  }
+  all_nodes_.clear();
+  for (int i = 0; i < GetNumNodes(); ++i) {
+    Node* node = GetNode(i);
+    all_nodes_.push_back(node);
+    if (node->IsEvidence()) {
+      continue;
+    }
+    if (dynamic_cast<ContinuousNode*>(node) == nullptr) {
+      std::cerr << "VariationalEngine node [" << node->GetName()
+                << "] is not continuous; use MetroSampler or GibbsSampler" << std::endl;
+      latent_idxs_.clear();
+      latent_nodes_.clear();
+      lower_bounds_.clear();
+      widths_.clear();
+      return false;
+    }
+    latent_idxs_.push_back(i);
+    latent_nodes_.push_back(node);
+    const UniformNode* uniform_node = dynamic_cast<const UniformNode*>(node);
+    if (uniform_node != nullptr) {
+      lower_bounds_.push_back(uniform_node->GetFrom());
+      widths_.push_back(uniform_node->GetTo() - uniform_node->GetFrom());
+    } else {
+      lower_bounds_.push_back(0.0);
+      widths_.push_back(0.0);
+    }
+  }
+  const int dim = latent_nodes_.size();
+  for (Node* node : latent_nodes_) {
+    if (!node->IsInitialized()) {
+      Sampler::Reset();
+      break;
+    }
+  }
+  means_.resize(dim);
+  for (int i = 0; i < dim; ++i) {
+    means_[i] = latent_nodes_[i]->GetValue();
+    if (widths_[i] > 0.0) {
+      // Inverse of GetNodeValue(), kept off the boundary where it diverges.
+      const double fraction = std::min(std::max((means_[i] - lower_bounds_[i]) / widths_[i],
+                                                kMinBoundedFraction),
+                                       1.0 - kMinBoundedFraction);
+      means_[i] = log(fraction / (1.0 - fraction));
+    }
+  }
+  log_sigmas_.assign(dim, 0.0);
+  ResetAdamState();
+  epsilon_.resize(dim);
+  z_.resize(dim);
+  mean_gradient_.resize(dim);
+  log_sigma_gradient_.resize(dim);
+  return true;
+}
+
+void VariationalEngine::ResetAdamState() {
+  const int dim = latent_nodes_.size();
+  mean_moment1_.assign(dim, 0.0);
+  mean_moment2_.assign(dim, 0.0);
+  log_sigma_moment1_.assign(dim, 0.0);
+  log_sigma_moment2_.assign(dim, 0.0);
+  // Restarts the bias correction.
+  num_steps_ = 0;
+}
+
+std::vector<double> VariationalEngine::GetEvidenceValues() const {
+  std::vector<double> values;
+  for (const Node* node : all_nodes_) {
+    if (node->IsEvidence()) {
+      values.push_back(node->GetValue());
+    }
+  }
+  return values;
+}
+
+void VariationalEngine::Reset() {
+  Sampler::Reset();
+  // FindLatentNodes() starts the next fit from the values just drawn.
+  latent_idxs_.clear();
+  latent_nodes_.clear();
+  lower_bounds_.clear();
+  widths_.clear();
+  means_.clear();
+  log_sigmas_.clear();
+  fitted_evidence_.clear();
+  elbo_ = 0.0;
+  is_fitted_ = false;
+}
+
+double VariationalEngine::GetNodeValue(int latent_idx, double z) const {
+  if (widths_[latent_idx] == 0.0) {
+    return z;
+  }
+  return lower_bounds_[latent_idx] + widths_[latent_idx] / (1.0 + exp(-z));
+}
+
+double VariationalEngine::GetJacobian(int latent_idx, double z) const {
+  return exp(GetLogJacobian(latent_idx, z));
+}
+
+double VariationalEngine::GetLogJacobian(int latent_idx, double z) const {
+  if (widths_[latent_idx] == 0.0) {
+    return 0.0;
+  }
+  // log(width * sigmoid(z) * sigmoid(-z)), without overflow for large |z|.
+  return log(widths_[latent_idx]) - fabs(z) - 2.0 * log1p(exp(-fabs(z)));
+}
+
+double VariationalEngine::GetLogJacobianGradient(int latent_idx, double z) const {
+  if (widths_[latent_idx] == 0.0) {
+    return 0.0;
+  }
+  return 1.0 - 2.0 / (1.0 + exp(-z));
+}
+
+double VariationalEngine::GetBlanketLogDensity(Node* node) const {
+  double log_density = TemperedLogConditional(node);
+  for (Node* child : node->GetChildren()) {
+    log_density += TemperedLogConditional(child);
+  }
+  return log_density;
+}
+
+double VariationalEngine::GetLogJoint() {
+  double log_joint = 0.0;
+  for (Node* node : all_nodes_) {
+    log_joint += TemperedLogConditional(node);
+  }
+  return log_joint;
+}
+
+double VariationalEngine::GetLogJointGradient(int latent_idx) {
+  // Only factors in the node's Markov blanket depend on its value.
+  Node* node = latent_nodes_[latent_idx];
+  const double value = node->GetValue();
+  const double step = kDifferenceStep * std::max(1.0, fabs(value));
+  node->SetValue(value + step);
+  const double forward = GetBlanketLogDensity(node);
+  node->SetValue(value - step);
+  const double backward = GetBlanketLogDensity(node);
+  node->SetValue(value);
+  return (forward - backward) / (2.0 * step);
+}
+
+void VariationalEngine::AdamUpdate(const std::vector<double>& gradient,
+                                   std::vector<double>* first_moment,
+                                   std::vector<double>* second_moment,
+                                   std::vector<double>* parameters) {
+  const double first_correction = 1.0 - pow(kAdamBeta1, num_steps_);
+  const double second_correction = 1.0 - pow(kAdamBeta2, num_steps_);
+  for (int i = 0; i < gradient.size(); ++i) {
+    (*first_moment)[i] = kAdamBeta1 * (*first_moment)[i] + (1.0 - kAdamBeta1) * gradient[i];
+    (*second_moment)[i] = kAdamBeta2 * (*second_moment)[i] + (1.0 - kAdamBeta2) * gradient[i] * gradient[i];
+    // Ascent: the ELBO is maximized.
+    (*parameters)[i] += learning_rate_ * ((*first_moment)[i] / first_correction) /
+                        (sqrt((*second_moment)[i] / second_correction) + kAdamEpsilon);
+  }
+}
+
+bool VariationalEngine::Fit(int max_iterations) {
+  if (IsVerbose()) {
+    std::cerr << "VariationalEngine::Fit going for up to " << max_iterations << " iterations" << std::endl;
+  }
+  if (!FindLatentNodes()) {
+    return false;
+  }
+  const int dim = latent_nodes_.size();
+  std::vector<double> evidence = GetEvidenceValues();
+  if (is_fitted_ && evidence != fitted_evidence_) {
+    // The means are a warm start for the new posterior, but the moments
+    // track gradients of the old one.
+    ResetAdamState();
+  }
+  fitted_evidence_.swap(evidence);
+  is_fitted_ = true;
+  double window_elbo = 0.0;
+  double previous_window_elbo = 0.0;
+  bool has_previous_window = false;
+  for (int iteration = 1; iteration <= max_iterations; ++iteration) {
+    mean_gradient_.assign(dim, 0.0);
+    log_sigma_gradient_.assign(dim, 0.0);
+    double elbo = 0.0;
+    for (int sample = 0; sample < num_monte_carlo_samples_; ++sample) {
+      for (int i = 0; i < dim; ++i) {
+        epsilon_[i] = standard_normal_.Draw();
+        z_[i] = means_[i] + exp(log_sigmas_[i]) * epsilon_[i];
+        latent_nodes_[i]->SetValue(GetNodeValue(i, z_[i]));
+      }
+      for (int i = 0; i < dim; ++i) {
+        // Chain rule through the support transform, plus its Jacobian term.
+        const double gradient = GetLogJointGradient(i) * GetJacobian(i, z_[i]) +
+                                GetLogJacobianGradient(i, z_[i]);
+        mean_gradient_[i] += gradient;
+        log_sigma_gradient_[i] += gradient * epsilon_[i] * exp(log_sigmas_[i]);
+        elbo += GetLogJacobian(i, z_[i]);
+      }
+      elbo += GetLogJoint();
+    }
+    elbo /= num_monte_carlo_samples_;
+    for (int i = 0; i < dim; ++i) {
+      mean_gradient_[i] /= num_monte_carlo_samples_;
+      // The entropy of the approximation adds exactly 1 per log sigma.
+      log_sigma_gradient_[i] = log_sigma_gradient_[i] / num_monte_carlo_samples_ + 1.0;
+      elbo += log_sigmas_[i];
+    }
+
+    ++num_steps_;
+    AdamUpdate(mean_gradient_, &mean_moment1_, &mean_moment2_, &means_);
+    AdamUpdate(log_sigma_gradient_, &log_sigma_moment1_, &log_sigma_moment2_, &log_sigmas_);
+
+    window_elbo += elbo / kElboWindow;
+    if (iteration % kElboWindow == 0) {
+      elbo_ = window_elbo;
+      if (has_previous_window &&
+          fabs(window_elbo - previous_window_elbo) < tolerance_ * fabs(previous_window_elbo)) {
+        if (IsVerbose()) {
+          std::cerr << "VariationalEngine::Fit converged after " << iteration
+                    << " iterations, ELBO " << elbo_ << std::endl;
+        }
+        return true;
+      }
+      previous_window_elbo = window_elbo;
+      has_previous_window = true;
+      window_elbo = 0.0;
+    }
+    if (IsCancelled()) {
+      if (IsVerbose()) {
+        std::cerr << "VariationalEngine::Fit cancelled after " << iteration << " iterations" << std::endl;
+      }
+      return false;
+    }
+  }
+  std::cerr << "VariationalEngine::Fit did not converge, ELBO " << elbo_ << std::endl;
+  return false;
+}
+
+void VariationalEngine::Infer(int num_iterations) {
+  if (IsVerbose()) {
+    std::cerr << "VariationalEngine::Infer going for " << num_iterations << " iterations" << std::endl;
+  }
+  if (!is_fitted_ || GetEvidenceValues() != fitted_evidence_) {
+    Fit(kDefaultMaxFitIterations);
+  }
+  if (!FindLatentNodes()) {
+    return;
+  }
+  for (int iteration = 0; iteration < num_iterations; ++iteration) {
+    for (int i = 0; i < latent_nodes_.size(); ++i) {
+      latent_nodes_[i]->SetValue(GetNodeValue(i, means_[i] + exp(log_sigmas_[i]) * standard_normal_.Draw()));
+    }
+    if (!EndSweep()) {
+      if (IsVerbose()) {
+        std::cerr << "VariationalEngine::Infer cancelled after " << iteration + 1 << " iterations" << std::endl;
+      }
+      break;
+    }
+  }
+  if (IsVerbose()) {
+    std::cerr << "VariationalEngine::Infer done" << std::endl;
+  }
+}
+
+void VariationalEngine::InitializeChain(Sampler* sampler) const {
+  for (int i = 0; i < latent_idxs_.size(); ++i) {
+    Node* node = sampler->GetNode(latent_idxs_[i]);
+    node->SetValue(GetNodeValue(i, means_[i]));
+    node->SetInitialized();
+  }
+}
+
+void VariationalEngine::SeedEngine(uint64_t engine_seed) {
+  standard_normal_.Seed(engine_seed);
+}
+
+void VariationalEngine::SaveEngineState(sampler::StateWriter* writer) const {
+  writer->WriteInt64(is_fitted_);
+  writer->WriteInt64(num_steps_);
+  writer->WriteDouble(elbo_);
+  writer->WriteDoubles(means_);
+  writer->WriteDoubles(log_sigmas_);
+  writer->WriteDoubles(mean_moment1_);
+  writer->WriteDoubles(mean_moment2_);
+  writer->WriteDoubles(log_sigma_moment1_);
+  writer->WriteDoubles(log_sigma_moment2_);
+  writer->WriteDoubles(fitted_evidence_);
+  standard_normal_.SaveState(writer);
+}
+
+bool VariationalEngine::LoadEngineState(sampler::StateReader* reader) {
+  int64_t is_fitted = 0;
+  int64_t num_steps = 0;
+  double elbo = 0.0;
+  if (!reader->ReadInt64(&is_fitted) || !reader->ReadInt64(&num_steps) ||
+      !reader->ReadDouble(&elbo)) {
+    return false;
+  }
+  // Before restoring num_steps_, which FindLatentNodes() resets.
+  if (is_fitted && !FindLatentNodes()) {
+    return false;
+  }
+  is_fitted_ = is_fitted;
+  num_steps_ = num_steps;
+  elbo_ = elbo;
+  // Node values were already restored; only the parameters come from here.
+  return reader->ReadDoubles(&means_) && reader->ReadDoubles(&log_sigmas_) &&
+         reader->ReadDoubles(&mean_moment1_) && reader->ReadDoubles(&mean_moment2_) &&
+         reader->ReadDoubles(&log_sigma_moment1_) && reader->ReadDoubles(&log_sigma_moment2_) &&
+         reader->ReadDoubles(&fitted_evidence_) &&
+         means_.size() == latent_nodes_.size() && log_sigmas_.size() == latent_nodes_.size() &&
+         standard_normal_.LoadState(reader);
+}
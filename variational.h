@@ -0,0 +1,112 @@
+#ifndef SAMPLER_VARIATIONAL_H_
+#define SAMPLER_VARIATIONAL_H_
+
+#include <vector>
+
+#include "framework.h"
+
+// Automatic differentiation variational inference (ADVI) with a mean-field
+// Gaussian over the non-evidence ContinuousNodes. Fit() maximizes the ELBO
+// by stochastic gradient ascent with reparameterized draws
+// z = mu + exp(omega) * eps. Gradients of the log joint come from central
+// differences of each node's Markov blanket log density, so any node
+// implementing GetLogConditional() works. Infer() then feeds independent
+// draws from the fit to the Worker. The fit is approximate; it can seed a
+// MetroSampler via InitializeChain() for refinement.
+//
+// As in ADVI, nodes with bounded support (UniformNode on [from, to)) are
+// fit in an unconstrained coordinate z, with value
+// from + (to - from) * sigmoid(z) and the log Jacobian of that map added
+// to the log joint. Their Gaussian, and so GetMeans() and
+// GetStandardDeviations(), is over z.
+class VariationalEngine : public Sampler {
+  public:
+  VariationalEngine();
+
+  // Adam step size on mu and omega. Defaults to 0.05.
+  void SetLearningRate(double learning_rate);
+  // Draws averaged per gradient step. Defaults to 1.
+  void SetNumMonteCarloSamples(int num_samples);
+  // Fit() stops once the mean ELBO over consecutive windows of iterations
+  // changes by less than tolerance, relatively. Defaults to 1e-3.
+  void SetTolerance(double tolerance);
+
+  // Draws new node values and discards the fit; the next Fit() starts
+  // from those values.
+  void Reset() override;
+  // Runs up to max_iterations gradient steps, starting from the current
+  // node values (drawn by Reset() if not yet initialized). Returns true if
+  // the ELBO converged. Later calls continue from the current fit, with
+  // fresh Adam moments if evidence values changed since.
+  bool Fit(int max_iterations);
+  // Fits with a default budget first if Fit() was not called since
+  // Reset(), or if evidence values changed since the last Fit().
+  void Infer(int num_iterations) override;
+
+  // Variational parameters of the latent nodes, in registration order.
+  const std::vector<double>& GetMeans() const;
+  std::vector<double> GetStandardDeviations() const;
+  // Mean ELBO, up to the normalizers GetLogConditional() omits, over the
+  // last full window of Fit().
+  double GetElbo() const;
+
+  // Sets the latent nodes of sampler, built from the same model, to the
+  // variational means. Call Infer() on it without Reset() to refine.
+  void InitializeChain(Sampler* sampler) const;
+
+  protected:
+  void SeedEngine(uint64_t engine_seed) override;
+  void SaveEngineState(sampler::StateWriter* writer) const override;
+  bool LoadEngineState(sampler::StateReader* reader) override;
+
+  private:
+  bool FindLatentNodes();
+  void ResetAdamState();
+  // Values of the evidence nodes, in registration order.
+  std::vector<double> GetEvidenceValues() const;
+  // Node value at unconstrained coordinate z of latent node latent_idx,
+  // dx/dz there, and log dx/dz with its derivative in z.
+  double GetNodeValue(int latent_idx, double z) const;
+  double GetJacobian(int latent_idx, double z) const;
+  double GetLogJacobian(int latent_idx, double z) const;
+  double GetLogJacobianGradient(int latent_idx, double z) const;
+  double GetBlanketLogDensity(Node* node) const;
+  double GetLogJoint();
+  double GetLogJointGradient(int latent_idx);
+  void AdamUpdate(const std::vector<double>& gradient,
+                  std::vector<double>* first_moment,
+                  std::vector<double>* second_moment,
+                  std::vector<double>* parameters);
+
+  std::vector<int> latent_idxs_;
+  std::vector<Node*> latent_nodes_;
+  std::vector<Node*> all_nodes_;
+  // Support [lower, lower + width) of each latent node; width 0 for
+  // unbounded nodes, which need no transform.
+  std::vector<double> lower_bounds_;
+  std::vector<double> widths_;
+  std::vector<double> means_;
+  std::vector<double> log_sigmas_;
+  // Adam moment estimates for means_ and log_sigmas_.
+  std::vector<double> mean_moment1_;
+  std::vector<double> mean_moment2_;
+  std::vector<double> log_sigma_moment1_;
+  std::vector<double> log_sigma_moment2_;
+  // GetEvidenceValues() at the last Fit().
+  std::vector<double> fitted_evidence_;
+  // Scratch for one step.
+  std::vector<double> epsilon_;
+  std::vector<double> z_;
+  std::vector<double> mean_gradient_;
+  std::vector<double> log_sigma_gradient_;
+
+  double learning_rate_;
+  int num_monte_carlo_samples_;
+  double tolerance_;
+  int64_t num_steps_;
+  double elbo_;
+  bool is_fitted_;
+  GaussianSource standard_normal_;
+};
+
+#endif  // SAMPLER_VARIATIONAL_H_
@@ -0,0 +1,211 @@
+#include <cmath>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "framework.h"
+#include "test_util.h"
+#include "variational.h"
+
+namespace {
+
+// Running mean of node 0.
+class MeanWorker : public Worker {
+  public:
+  MeanWorker() : sum_(0.0), num_samples_(0) {}
+  void Reset() override {
+    sum_ = 0.0;
+    num_samples_ = 0;
+  }
+  void Sample(Sampler* sampler) override {
+    sum_ += sampler->GetNode(0)->GetValue();
+    ++num_samples_;
+  }
+  std::string ToJsonString() const override { return "{}"; }
+  double GetMean() const { return sum_ / num_samples_; }
+
+  private:
+  double sum_;
+  int64_t num_samples_;
+};
+
+double GetWorkerMean(Sampler* sampler) {
+  return static_cast<const MeanWorker*>(sampler->GetWorker())->GetMean();
+}
+
+// x ~ N(1, 4) and observed y | x ~ N(2 x, 1): the posterior of x is
+// Gaussian with precision 1 / 4 + 4 and mean (1 / 4 + 2 y) / precision, so
+// the mean-field optimum is exact. Stochastic steps leave the fit within a
+// few hundredths of it; the checks allow 0.1.
+const int kEvidenceIdx = 1;
+const double kPosteriorPrecision = 4.25;
+
+double GetPosteriorMean(double y) {
+  return (0.25 + 2.0 * y) / kPosteriorPrecision;
+}
+
+void AddLinearModel(Sampler* sampler, double y) {
+  Node* x = new GaussianNode({1.0}, 4.0, "x");
+  Node* y_node = new GaussianEvidenceNode({0.0, 2.0}, 1.0, y, "y");
+  y_node->EdgeFrom(x);
+  sampler->Register(x);
+  sampler->Register(y_node);
+  sampler->Register(new MeanWorker);
+}
+
+VariationalEngine* NewLinearEngine(double y) {
+  VariationalEngine* engine = new VariationalEngine;
+  engine->SetVerbose(false);
+  engine->SetLearningRate(0.01);
+  engine->SetNumMonteCarloSamples(8);
+  AddLinearModel(engine, y);
+  return engine;
+}
+
+void TestLinearGaussianFit() {
+  std::unique_ptr<VariationalEngine> engine(NewLinearEngine(3.0));
+  engine->Reset();
+  EXPECT_TRUE(engine->Fit(20000));
+  EXPECT_TRUE(engine->GetMeans().size() == 1);
+  EXPECT_NEAR(engine->GetMeans()[0], GetPosteriorMean(3.0), 0.1);
+  EXPECT_NEAR(engine->GetStandardDeviations()[0], 1.0 / sqrt(kPosteriorPrecision), 0.05);
+  EXPECT_TRUE(std::isfinite(engine->GetElbo()));
+
+  engine->Infer(20000);
+  EXPECT_NEAR(GetWorkerMean(engine.get()), GetPosteriorMean(3.0), 0.1);
+}
+
+// Convergence needs two full ELBO windows to compare.
+void TestConvergenceDetection() {
+  std::unique_ptr<VariationalEngine> engine(NewLinearEngine(3.0));
+  engine->Reset();
+  EXPECT_TRUE(!engine->Fit(50));
+  EXPECT_TRUE(engine->Fit(20000));
+  // A tolerance no window can meet runs the whole budget.
+  engine->SetTolerance(0.0);
+  EXPECT_TRUE(!engine->Fit(500));
+}
+
+// Infer() fits again once the evidence changes, and after Reset().
+void TestRefit() {
+  std::unique_ptr<VariationalEngine> engine(NewLinearEngine(3.0));
+  engine->Reset();
+  engine->Infer(5000);
+  EXPECT_NEAR(GetWorkerMean(engine.get()), GetPosteriorMean(3.0), 0.1);
+
+  engine->GetNode(kEvidenceIdx)->SetValue(-3.0);
+  engine->Reset();
+  EXPECT_TRUE(engine->GetMeans().empty());
+  engine->Infer(5000);
+  EXPECT_NEAR(engine->GetMeans()[0], GetPosteriorMean(-3.0), 0.1);
+  EXPECT_NEAR(GetWorkerMean(engine.get()), GetPosteriorMean(-3.0), 0.1);
+
+  // Without Reset(), as a BatchQueryRunner might not.
+  engine->GetNode(kEvidenceIdx)->SetValue(1.0);
+  engine->GetWorker()->Reset();
+  engine->Infer(5000);
+  EXPECT_NEAR(engine->GetMeans()[0], GetPosteriorMean(1.0), 0.1);
+  EXPECT_NEAR(GetWorkerMean(engine.get()), GetPosteriorMean(1.0), 0.1);
+}
+
+// u ~ U(0, 2) and observed y | u ~ N(u, 0.25) = 1.5: the posterior is that
+// Gaussian truncated to [0, 2), with mean 1.5 - 0.5 (phi(1) - phi(-3)) /
+// (Phi(1) - Phi(-3)).
+const double kTruncatedMean = 1.3586;
+
+void AddUniformModel(Sampler* sampler) {
+  Node* u = new UniformNode(0.0, 2.0, "u");
+  Node* y = new GaussianEvidenceNode({0.0, 1.0}, 0.25, 1.5, "y");
+  y->EdgeFrom(u);
+  sampler->Register(u);
+  sampler->Register(y);
+  sampler->Register(new MeanWorker);
+}
+
+// The fit is over the logit of u, so every draw stays in bounds and the
+// approximation, though not exact, lands near the truncated mean.
+void TestBoundedNode() {
+  VariationalEngine engine;
+  engine.SetVerbose(false);
+  engine.SetLearningRate(0.01);
+  engine.SetNumMonteCarloSamples(8);
+  AddUniformModel(&engine);
+  engine.Reset();
+  EXPECT_TRUE(engine.Fit(20000));
+  bool is_in_bounds = true;
+  double sum = 0.0;
+  const int kNumDraws = 20000;
+  for (int i = 0; i < kNumDraws; ++i) {
+    engine.Infer(1);
+    const double value = engine.GetNode(0)->GetValue();
+    is_in_bounds = is_in_bounds && value >= 0.0 && value < 2.0;
+    sum += value;
+  }
+  EXPECT_TRUE(is_in_bounds);
+  EXPECT_NEAR(sum / kNumDraws, kTruncatedMean, 0.1);
+
+  // A chain started from the fit starts at its mean, mapped into bounds.
+  MetroSampler chain(new GaussianProposalDensity1D(0.5));
+  chain.SetVerbose(false);
+  AddUniformModel(&chain);
+  engine.InitializeChain(&chain);
+  const double mean = engine.GetMeans()[0];
+  EXPECT_NEAR(chain.GetNode(0)->GetValue(), 2.0 / (1.0 + exp(-mean)), 1e-12);
+  EXPECT_TRUE(chain.GetNode(0)->IsInitialized());
+}
+
+// InitializeChain() on a Gaussian model: the chain continues from the fit
+// without Reset().
+void TestInitializeChain() {
+  std::unique_ptr<VariationalEngine> engine(NewLinearEngine(3.0));
+  engine->Reset();
+  EXPECT_TRUE(engine->Fit(20000));
+  MetroSampler chain(new GaussianProposalDensity1D(0.5));
+  chain.SetVerbose(false);
+  AddLinearModel(&chain, 3.0);
+  engine->InitializeChain(&chain);
+  EXPECT_TRUE(chain.GetNode(0)->GetValue() == engine->GetMeans()[0]);
+  chain.Infer(20000);
+  EXPECT_NEAR(GetWorkerMean(&chain), GetPosteriorMean(3.0), 0.1);
+}
+
+// A restored engine neither refits nor diverges from the original.
+void TestSnapshotRestore() {
+  std::unique_ptr<VariationalEngine> original(NewLinearEngine(3.0));
+  original->Reset();
+  original->Infer(100);
+  const std::string snapshot = original->Snapshot();
+  original->Infer(1000);
+
+  std::unique_ptr<VariationalEngine> restored(NewLinearEngine(3.0));
+  EXPECT_TRUE(restored->Restore(snapshot));
+  restored->Infer(1000);
+  EXPECT_TRUE(restored->GetMeans() == original->GetMeans());
+  EXPECT_TRUE(restored->GetStandardDeviations() == original->GetStandardDeviations());
+  EXPECT_TRUE(restored->GetNode(0)->GetValue() == original->GetNode(0)->GetValue());
+  EXPECT_TRUE(restored->Snapshot() == original->Snapshot());
+
+  // Mid-fit, the Adam state carries over too.
+  std::unique_ptr<VariationalEngine> fitting(NewLinearEngine(3.0));
+  fitting->Reset();
+  fitting->Fit(50);
+  const std::string fit_snapshot = fitting->Snapshot();
+  fitting->Fit(50);
+  std::unique_ptr<VariationalEngine> resumed(NewLinearEngine(3.0));
+  EXPECT_TRUE(resumed->Restore(fit_snapshot));
+  resumed->Fit(50);
+  EXPECT_TRUE(resumed->GetMeans() == fitting->GetMeans());
+  EXPECT_TRUE(resumed->Snapshot() == fitting->Snapshot());
+}
+
+}  // namespace
+
+int main() {
+  TestLinearGaussianFit();
+  TestConvergenceDetection();
+  TestRefit();
+  TestBoundedNode();
+  TestInitializeChain();
+  TestSnapshotRestore();
+  return sampler::testing::TestResult();
+}